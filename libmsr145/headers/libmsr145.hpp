@@ -12,38 +12,109 @@
 #include <string>
 #include <ctime>
 #include <vector>
+#include <functional>
+#include <atomic>
 #include "libmsr145_enums.hpp"
 #include "libmsr145_structs.hpp"
-
-#define MSR_BUAD_RATE 9600
-#define MSR_STOP_BITS boost::asio::serial_port_base::stop_bits::one
-#define MSR_WORD_length 8
+#include "libmsr145_transport.hpp"
+#include "libmsr145_errors.hpp"
+#include "libmsr145_metrics.hpp"
+#include "libmsr145_lock.hpp"
+#include "libmsr145_discovery.hpp"
+#include "libmsr145_livestream.hpp"
+#include "libmsr145_coalescer.hpp"
+#include "libmsr145_shm.hpp"
+#include "libmsr145_rules.hpp"
+#include "libmsr145_units.hpp"
+#include "libmsr145_reactor.hpp"
 
 
 
 class MSR_Base
-{
+{   //Commands are send under port_lock, so the device can be shared between threads.
+    //Each thread sends with its own priority, so short reads can slot in between the page fetches of an extraction.
     protected:
-        boost::asio::serial_port *port;
-        boost::asio::io_service ioservice;
+        MSR_Transport *transport;
+        MSR_PriorityLock port_lock;
+        static thread_local int thread_priority;
         std::string portname;
-        boost::asio::deadline_timer *read_timer;
+        uint32_t cur_baud = MSR_BUAD_RATE;
+        uint32_t session_baud = MSR_BUAD_RATE; //the lowest baudrate set_baud will go to, see set_session_baud
+        unsigned retry_budget = 5; //number of retries before send_command gives up
+        int64_t initial_allowance = 500000; //in us, the allowance for the device's answer until a round trip is measured
+        //Smoothed round trip time and its variation in us for each opcode, like the TCP retransmission timer.
+        //The round trip time does not include the time it takes to send the bytes. 0 means not measured yet.
+        int64_t srtt[256] = {};
+        int64_t rttvar[256] = {};
+        //Pacing. The gap is the time in us to wait after a command with the given opcode before sending the next one.
+        //It is increased multiplicatively when the next command is answered busy or not at all,
+        //and decreased additively while the device keeps up (AIMD).
+        int64_t pacing_gap[256] = {};
+        int64_t pacing_min_gap[256] = {};
+        uint64_t pacing_sent[256] = {};
+        uint64_t pacing_busy[256] = {};
+        uint64_t pacing_timeouts[256] = {};
+        uint8_t last_opcode = 0;
+        std::chrono::steady_clock::time_point last_command_end;
+        MSR_Metrics metrics;
     public:
         MSR_Base(std::string _portname);
+        MSR_Base(MSR_Transport *_transport); //takes ownership of _transport
         virtual ~MSR_Base();
+        virtual void start_capture(std::string filename); //record all traffic to a trace file
         virtual void set_baud(uint32_t baudrate);
+        //Keeps the baudrate at least at baudrate, for processes which keep the device open. Lower baudrates given to
+        //set_baud are ignored, so the extractions don't go back to 9600. 9600 ends the session.
+        //The device falls back to 9600 after ~5 seconds without commands, so keep it busy.
+        virtual void set_session_baud(uint32_t baudrate);
+        virtual uint32_t get_baud() { return cur_baud; }
+        virtual uint32_t get_session_baud() { return session_baud; } //MSR_BUAD_RATE when there is no session
+        virtual void set_retry_budget(unsigned retries);
+        virtual void set_initial_timeout(boost::posix_time::time_duration time_out); //e.g. shorter, to probe for devices
+        virtual std::vector<pacing_entry> get_pacing();
+        virtual void set_pacing_gap(uint8_t opcode, uint32_t gap); //e.g. to restore gaps learned in an earlier session
+        virtual MSR_Metrics &get_metrics() { return metrics; }
+        static void set_thread_priority(int priority) { thread_priority = priority; } //for the commands send by the calling thread
+        static int get_thread_priority() { return thread_priority; }
+        //Keeps other threads from sending commands until unlock_session, for groups of commands which must not be interrupted
+        virtual void lock_session() { port_lock.lock(thread_priority); }
+        virtual void unlock_session() { port_lock.unlock(); }
         virtual bool is_recording();
         virtual std::string get_L1_unit_str();  //unfortunately, we need to place this here, as it's needed in the writer
         virtual void get_L1_offset_gain(float *offset, float *gain);  //unfortunately, we need to place this here, as it's needed in the writer
         virtual void get_calibrationdata(calibration_type::calibration_type type, uint16_t *point_1_target, uint16_t *point_1_actual,
             uint16_t *point_2_target, uint16_t *point_2_actual); //unfortunately, we need to place this here, as it's needed in the writer
+        virtual DeviceSnapshot get_snapshot(std::vector<sampletype> sensor_types = std::vector<sampletype>()) = 0; //unfortunately, we need to place this here, as it's needed in the writer
+        virtual DeviceSnapshot get_snapshot(const DeviceConfig &config) = 0; //unfortunately, we need to place this here, as it's needed in the writer
+        virtual std::vector<rec_entry> get_rec_list(size_t max_num = 0) = 0; //unfortunately, we need to place this here, as it's needed in the writer
         virtual int send_command(uint8_t *command, size_t command_length, uint8_t *out, size_t out_length);
+        //The steps of send_command, for a thread which waits for many devices at once (see DeviceReactor).
+        //Take the session with try_lock_session, and keep it until the command is done. For each attempt, wait
+        //until get_send_time, call begin_attempt, and call receive when the fd is readable, until it returns true
+        //or the deadline of the attempt has passed. end_attempt then tells what to do next, or throws
+        //msr_timeout_error when the retries are used up.
+        virtual bool try_lock_session(int priority, uint64_t &ticket) { return port_lock.try_lock(priority, ticket); }
+        virtual void cancel_lock_session(int priority, uint64_t &ticket) { port_lock.cancel(priority, ticket); }
+        virtual int get_fd() { return transport->get_fd(); } //-1 if the transport can't be waited on
+        virtual std::chrono::steady_clock::time_point get_send_time(); //when the pacing allows the next command
+        virtual void begin_attempt(command_state &state);
+        virtual bool receive(command_state &state);
+        virtual command_result::command_result end_attempt(command_state &state);
+        virtual std::chrono::milliseconds get_recovery_delay(unsigned attempt);
+        virtual void reset_link(unsigned attempt);
 
     protected:
+        bool baud_reset_pending = false; //reset_link told the device to go to 9600, and the transport must follow
         virtual void send_raw(uint8_t * command, size_t command_length, uint8_t *out, size_t out_length);
         virtual uint8_t calc_chksum(uint8_t *data, size_t length);
-        virtual int send_with_timeout(uint8_t *command, size_t command_length,
-                                    uint8_t *out, size_t out_length, boost::posix_time::time_duration time_out);
+        virtual void write_frame(uint8_t *command, size_t command_length);
+        virtual int64_t get_wire_time(size_t bytes); //in us at the current baudrate
+        virtual boost::posix_time::time_duration get_timeout(uint8_t opcode, size_t command_length, size_t out_length);
+        virtual void update_rtt(uint8_t opcode, int64_t rtt);
+        virtual void recover(unsigned attempt);
+        virtual void init_pacing();
+        virtual void wait_for_pacing();
+        virtual void update_pacing(uint8_t opcode, bool busy, bool timeout);
 
 
 };
@@ -52,7 +123,8 @@ class MSR_Writer : virtual public MSR_Base
 {
     public:
         MSR_Writer(std::string _portname) : MSR_Base(_portname) {};
-        virtual void format_memory();
+        MSR_Writer(MSR_Transport *_transport) : MSR_Base(_transport) {};
+        virtual void format_memory(bool fast = false);
         virtual void stop_recording();
 
         virtual int set_names_and_calibration_date(std::string deviceName, std::string calibrationName,
@@ -71,8 +143,15 @@ class MSR_Writer : virtual public MSR_Base
             uint16_t point_2_target, uint16_t point_2_actual);
         virtual int set_L1_unit(std::string unit);
         virtual int set_L1_offset_gain(float offset, float gain);
+        virtual int apply(const DeviceConfig &config);
     protected:
         virtual void insert_time_in_command(struct tm *timeset, uint8_t *command);
+        virtual int write_names_and_calibration_date(std::string deviceName, std::string calibrationName,
+            uint8_t year, uint8_t month, uint8_t day, uint8_t active_calib);
+        virtual int write_limit(const limit_entry &limit, bool write_limit1, bool write_limit2);
+        virtual std::vector<uint16_t> get_used_sectors();
+        virtual void erase_sectors(const std::vector<uint16_t> &sectors);
+        virtual std::vector<std::function<int()> > diff_config(const DeviceConfig &config, const DeviceSnapshot &current);
 
 };
 
@@ -80,6 +159,7 @@ class MSR_Reader : virtual public MSR_Base
 {
     public:
         MSR_Reader(std::string _portname) : MSR_Base(_portname) {};
+        MSR_Reader(MSR_Transport *_transport) : MSR_Base(_transport) {};
         virtual std::string get_serial();
         virtual std::string get_name();
         virtual std::string get_calibration_name();
@@ -88,9 +168,24 @@ class MSR_Reader : virtual public MSR_Base
         virtual struct tm get_start_time();
         virtual struct tm get_end_time();
         virtual void update_sensors(); //not really sure which class to put this in.
+        //Triggers a conversion and returns as soon as the values have changed. As the device doesn't tell when it's
+        //done, values which don't change are waited for up to twice the latency seen on earlier changes, or max_wait.
+        virtual fresh_sensor_data get_fresh_sensor_data(std::vector<sampletype> &types,
+            std::chrono::milliseconds max_wait = std::chrono::milliseconds(1000));
         virtual std::vector<rec_entry> get_rec_list(size_t max_num = 0);
         virtual std::vector<sample> get_samples(rec_entry record);
+        //Returns the samples added to record since the last call with the same cursor. Pages already read are not
+        //fetched again, and while the record is active, only the live page is read, unless a page has been completed.
+        virtual std::vector<sample> get_new_samples(const rec_entry &record, follow_cursor &cursor);
+        //Reads the page currently recorded to. The status is read before and after the page, and the read is retried
+        //if the page was completed or restarted in between. If the page at known_address has no more than known_length
+        //bytes, it is not fetched again. known_time is the header timestamp the page at known_address had, if it is
+        //known. A page whose header differs from that, or from the one of the previous attempt, was rewritten at the
+        //same address, and is read again. Throws msr_error if the page changes on every one of max_retries reads.
+        virtual live_page get_live_page(uint16_t known_address = 0xFFFF, uint16_t known_length = 0,
+            uint64_t known_time = 0, unsigned max_retries = 5);
         virtual std::vector<int16_t> get_sensor_data(std::vector<sampletype> &types);
+        virtual void get_sensor_data(const sampletype *types, size_t count, int16_t *values); //doesn't allocate
         virtual uint32_t get_timer_interval(uint8_t t);
         virtual void get_active_measurements(uint8_t t, uint8_t *measurements, bool *blink);
         virtual void get_start_setting(bool *bufferon, startcondition *start);
@@ -101,15 +196,21 @@ class MSR_Reader : virtual public MSR_Base
         virtual void get_marker_setting(bool *marker_on, bool *alarm_confirm_on);
         virtual std::string get_calibration_name(uint8_t *year, uint8_t *month, uint8_t *day, uint8_t *active_calib);
         virtual void get_firmware_version(int *major, int *minor);
-    private:
-        virtual std::vector<std::pair<std::vector<uint8_t>, uint64_t> > get_raw_recording(rec_entry record);
+        virtual DeviceSnapshot get_snapshot(std::vector<sampletype> sensor_types = std::vector<sampletype>());
+        //Only reads the settings config sets, and those MSR_Writer::apply has to write again with them.
+        //The rest of the snapshot is zero.
+        virtual DeviceSnapshot get_snapshot(const DeviceConfig &config);
+    protected:
+        //longest latency in us seen for each sampletype, 0 if not seen yet. Atomic, as msr145d reads the sensors from
+        //several client threads at once.
+        std::atomic<int64_t> conversion_latency[16] = {};
+        virtual std::vector<raw_page> get_raw_recording(rec_entry record);
         virtual sample convert_to_sample(uint8_t *sample_ptr, uint64_t *total_time);
         virtual rec_entry create_rec_entry(uint8_t *response_ptr, uint16_t start_addr, uint16_t end_addr, bool active);
         virtual uint64_t get_page_timestamp(uint8_t *response);
-        virtual void get_live_data(std::vector<std::pair<std::vector<uint8_t>, uint64_t> > &sample_pages,
-            uint16_t cur_addr, bool isFirstPage);
-        virtual void add_raw_samples(std::vector<std::pair<std::vector<uint8_t>, uint64_t> > &sample_pages,
-            bool &end, uint8_t *response, size_t response_size, uint16_t start_pos, bool live, uint16_t page_num, uint16_t cur_addr);
+        virtual void add_raw_samples(std::vector<raw_page> &sample_pages,
+            bool &end, uint8_t *response, size_t response_size, uint16_t start_pos, uint16_t address);
+        virtual bool add_new_samples(uint8_t *response, size_t data_end, follow_cursor &cursor, std::vector<sample> &samples);
 
 };
 
@@ -118,4 +219,81 @@ class MSRDevice : public MSR_Writer, public MSR_Reader
     public:
         MSRDevice(std::string _portname) :
         MSR_Base(_portname), MSR_Writer(_portname), MSR_Reader(_portname) {};
+        MSRDevice(MSR_Transport *_transport) :
+        MSR_Base(_transport), MSR_Writer(_transport), MSR_Reader(_transport) {};
+};
+
+class MSR_PriorityScope
+{   //Sets the priority of the commands send by this thread, until the scope ends
+    protected:
+        int old_priority;
+    public:
+        MSR_PriorityScope(int priority) : old_priority(MSR_Base::get_thread_priority())
+            { MSR_Base::set_thread_priority(priority); }
+        ~MSR_PriorityScope() { MSR_Base::set_thread_priority(old_priority); }
+};
+
+class MSR_SessionGuard
+{
+    protected:
+        MSR_Base &device;
+    public:
+        MSR_SessionGuard(MSR_Base &_device) : device(_device) { device.lock_session(); }
+        ~MSR_SessionGuard() { device.unlock_session(); }
+        //Lets the threads waiting with a higher or the same priority send first, e.g. between the pages of an
+        //extraction. They change the baudrate through a MSR_BaudScope, so it is set back when we get the session again.
+        void yield() { device.unlock_session(); device.lock_session(); }
+};
+
+class MSR_BaudScope
+{   //Changes the baudrate for a group of commands, and sets the previous one again when the scope ends,
+    //also on exceptions. Does nothing while a session baudrate is set, as the session owns the baudrate.
+    //Hold a MSR_SessionGuard around it, so other threads don't send at the changed baudrate.
+    protected:
+        MSR_Base &device;
+        uint32_t old_baud;
+        bool changed = false;
+    public:
+        MSR_BaudScope(MSR_Base &_device, uint32_t baudrate) : device(_device), old_baud(_device.get_baud())
+        {
+            if(device.get_session_baud() != MSR_BUAD_RATE || baudrate == old_baud) return;
+            changed = true; //also if it fails half way, so the destructor tries to get back
+            device.set_baud(baudrate);
+        }
+        ~MSR_BaudScope()
+        {
+            if(!changed) return;
+            try
+            {
+                device.set_baud(old_baud);
+            }
+            catch(std::exception &)
+            {   //the device goes back to 9600 by itself after a few seconds without commands
+            }
+        }
+};
+
+class MSR_DeviceHandle
+{   //A handle to a device shared between threads, sending its commands with the given priority.
+    //E.g. a dashboard thread reading sensors through a handle with command_priority::live keeps updating
+    //while another thread extracts a recording through a handle with command_priority::bulk.
+    protected:
+        MSRDevice &device;
+        int priority;
+    public:
+        MSR_DeviceHandle(MSRDevice &_device, int _priority = command_priority::normal) :
+            device(_device), priority(_priority) {}
+        //Runs func(device). Commands of other threads may be send in between the commands func sends.
+        template<class F> auto run(F func) -> decltype(func(device))
+        {
+            MSR_PriorityScope scope(priority);
+            return func(device);
+        }
+        //As run, but no other thread can send commands until func returns
+        template<class F> auto run_session(F func) -> decltype(func(device))
+        {
+            MSR_PriorityScope scope(priority);
+            MSR_SessionGuard session(device);
+            return func(device);
+        }
 };
@@ -0,0 +1,58 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "libmsr145_enums.hpp"
+
+struct coalescer_stats
+{
+    uint64_t requests = 0;
+    uint64_t batches = 0;
+    uint64_t channels_requested = 0; //sum of the channels of all requests
+    uint64_t channels_read = 0; //after removing duplicates in each batch
+    uint64_t frames = 0; //0x82 0x02 commands send, each reading up to three channels
+};
+
+class MSR_Reader;
+
+class MSR_SensorCoalescer
+{   //Merges the sensor reads of many callers. Requests arriving within window of the first one in a batch
+    //are read together: the channels are deduplicated and packed three to a 0x82 0x02 frame, so the batch
+    //costs the fewest frames possible. Each caller gets its own channels back through a future.
+    protected:
+        struct request
+        {
+            std::vector<sampletype> types;
+            std::promise<std::vector<int16_t> > promise;
+        };
+        MSR_Reader &device;
+        std::chrono::microseconds window;
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::vector<request> pending;
+        bool stopping = false;
+        coalescer_stats stats;
+        std::thread thread;
+        virtual void work();
+        virtual void read_batch(std::vector<request> &batch);
+    public:
+        MSR_SensorCoalescer(MSR_Reader &_device, std::chrono::microseconds _window = std::chrono::milliseconds(5));
+        virtual ~MSR_SensorCoalescer();
+        //The future throws what the device throws, e.g. msr_timeout_error
+        virtual std::future<std::vector<int16_t> > request_sensor_data(const std::vector<sampletype> &types);
+        virtual std::vector<int16_t> get_sensor_data(const std::vector<sampletype> &types)
+            { return request_sensor_data(types).get(); }
+        virtual coalescer_stats get_stats();
+};
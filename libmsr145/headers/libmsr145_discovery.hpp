@@ -0,0 +1,47 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+#include <boost/asio.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+struct discovered_device
+{
+    std::string port;
+    std::string serial;
+    int firmware_major = 0;
+    int firmware_minor = 0;
+};
+
+class MSR_Discovery
+{   //Finds the MSR devices among serial ports. The ports are probed in parallel with short timeouts,
+    //so ports without a device only cost a fraction of a second.
+    //The serial -> port map is cached in cache_file (one "<serial> <port>" per line), so a device can be
+    //found again quickly when the ports have been renumbered. No cache is used if cache_file is empty.
+    protected:
+        std::string cache_file;
+        boost::posix_time::time_duration probe_timeout;
+        size_t max_threads;
+        virtual bool probe_port(const std::string &port, discovered_device &device);
+    public:
+        MSR_Discovery(std::string _cache_file = "",
+            boost::posix_time::time_duration _probe_timeout = boost::posix_time::milliseconds(100), size_t _max_threads = 32) :
+            cache_file(_cache_file), probe_timeout(_probe_timeout), max_threads(_max_threads) {}
+        virtual ~MSR_Discovery() {}
+        static std::vector<std::string> get_default_patterns(); //USB serial adapters and CDC ACM devices
+        //Probes the given ports, and updates the cache with the devices found
+        virtual std::vector<discovered_device> discover(const std::vector<std::string> &ports);
+        virtual std::map<std::string, std::string> load_cache();
+        virtual void save_cache(const std::map<std::string, std::string> &port_map);
+        //Returns the port of the device with the given serial. The cached port is tried first, then all ports matching
+        //the default patterns are probed. Throws std::runtime_error if the device is not found.
+        virtual std::string resolve(const std::string &serial);
+};
@@ -32,6 +32,15 @@ namespace active_measurement
     };
 }
 
+namespace command_result
+{
+    enum command_result
+    {   //what MSR_Base::end_attempt tells the caller to do next
+        done    = 0, //answered, or answered busy too many times
+        retry   = 1, //answered busy, send it again when the pacing allows it
+        recover = 2, //not answered, wait get_recovery_delay, call reset_link and send it again
+    };
+}
 
 enum startcondition
 {
@@ -0,0 +1,26 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+#include <stdexcept>
+#include <string>
+#include <cstdint>
+
+class msr_error : public std::runtime_error
+{   //Base class for errors in the communication with the device
+    public:
+        uint8_t opcode; //first byte of the command which failed
+        msr_error(const std::string &what, uint8_t _opcode) : std::runtime_error(what), opcode(_opcode) {}
+};
+
+class msr_timeout_error : public msr_error
+{   //The device did not answer within the retry budget
+    public:
+        msr_timeout_error(const std::string &what, uint8_t _opcode) : msr_error(what, _opcode) {}
+};
@@ -0,0 +1,98 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "libmsr145_enums.hpp"
+
+#define MSR_LIVE_MAX_CHANNELS 12
+
+struct live_reading
+{
+    std::chrono::steady_clock::time_point time; //when the answer was received
+    uint8_t count; //number of values
+    int16_t values[MSR_LIVE_MAX_CHANNELS]; //in the order the types were given to the stream
+};
+
+template<class T> class MSR_SpscRing
+{   //Lock free ring buffer for one producer and one consumer thread. The storage is allocated once.
+    protected:
+        std::vector<T> slots;
+        size_t mask;
+        alignas(64) std::atomic<size_t> head; //next slot to write, only changed by the producer
+        alignas(64) std::atomic<size_t> tail; //next slot to read, only changed by the consumer
+    public:
+        MSR_SpscRing(size_t capacity) : head(0), tail(0)
+        {   //the capacity is rounded up to a power of 2
+            size_t size = 1;
+            while(size < capacity) size <<= 1;
+            slots.resize(size);
+            mask = size - 1;
+        }
+        bool push(const T &item) //returns false if the ring is full
+        {
+            size_t cur_head = head.load(std::memory_order_relaxed);
+            if(cur_head - tail.load(std::memory_order_acquire) == slots.size()) return false;
+            slots[cur_head & mask] = item;
+            head.store(cur_head + 1, std::memory_order_release);
+            return true;
+        }
+        size_t pop(T *out, size_t max_count) //returns the number of items written to out
+        {
+            size_t cur_tail = tail.load(std::memory_order_relaxed);
+            size_t count = std::min(max_count, head.load(std::memory_order_acquire) - cur_tail);
+            for(size_t i = 0; i < count; i++)
+                out[i] = slots[(cur_tail + i) & mask];
+            tail.store(cur_tail + count, std::memory_order_release);
+            return count;
+        }
+        size_t size() { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+};
+
+class MSR_Reader;
+
+class LiveStream
+{   //Reads the given sensors at a fixed rate in its own thread, and queues the readings in a ring buffer.
+    //The commands are send with command_priority::live, so the device can be shared with e.g. an extraction.
+    //Nothing is allocated per reading. If the consumer doesn't keep up, readings are dropped and counted
+    //as overruns. If a reading takes longer than the interval, the missed readings are skipped and counted.
+    protected:
+        MSR_Reader &device;
+        sampletype types[MSR_LIVE_MAX_CHANNELS];
+        size_t type_count;
+        std::chrono::microseconds interval;
+        MSR_SpscRing<live_reading> ring;
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable stop_requested;
+        bool running = false;
+        std::atomic<uint64_t> readings;
+        std::atomic<uint64_t> overruns;
+        std::atomic<uint64_t> missed_deadlines;
+        std::atomic<uint64_t> errors; //readings which failed, because the device didn't answer or the port failed
+        virtual void poll();
+    public:
+        LiveStream(MSR_Reader &_device, const std::vector<sampletype> &_types, std::chrono::microseconds _interval,
+            size_t capacity = 4096);
+        virtual ~LiveStream();
+        virtual void start();
+        virtual void stop();
+        virtual size_t drain(live_reading *out, size_t max_count); //returns the number of readings written to out
+        virtual size_t drain(const std::function<void(const live_reading &reading)> &callback);
+        virtual uint64_t get_readings() { return readings; }
+        virtual uint64_t get_overruns() { return overruns; }
+        virtual uint64_t get_missed_deadlines() { return missed_deadlines; }
+        virtual uint64_t get_errors() { return errors; }
+};
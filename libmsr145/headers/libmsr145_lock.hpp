@@ -0,0 +1,57 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <set>
+#include <cstdint>
+
+#define MSR_NO_TICKET UINT64_MAX //for MSR_PriorityLock::try_lock, not waiting for the lock
+
+namespace command_priority
+{
+    enum command_priority
+    {
+        bulk    = 0, //e.g. page fetches when extracting a recording
+        normal  = 1,
+        live    = 2, //short reads which should not wait for a bulk transfer
+    };
+}
+
+class MSR_PriorityLock
+{   //Mutex where waiting threads are let in by priority, and in order of arrival for equal priorities.
+    //The owning thread may lock it again, it's released when it has been unlocked as many times.
+    protected:
+        std::mutex mutex;
+        std::condition_variable released;
+        std::thread::id owner;
+        unsigned depth = 0;
+        uint64_t next_ticket = 0;
+        std::set<std::pair<int, uint64_t> > waiting; //(-priority, ticket), so the first one is the next to get the lock
+    public:
+        void lock(int priority);
+        void unlock();
+        //Takes the lock if it's our turn, without waiting. Else the caller is put in line with ticket, like a waiting
+        //thread, and must call again with the same ticket until it gets the lock, or cancel the ticket.
+        //Start with ticket set to MSR_NO_TICKET, it is set back to that when the lock is taken.
+        bool try_lock(int priority, uint64_t &ticket);
+        void cancel(int priority, uint64_t &ticket);
+};
+
+class MSR_PriorityGuard
+{
+    protected:
+        MSR_PriorityLock &priority_lock;
+    public:
+        MSR_PriorityGuard(MSR_PriorityLock &_priority_lock, int priority) : priority_lock(_priority_lock)
+            { priority_lock.lock(priority); }
+        ~MSR_PriorityGuard() { priority_lock.unlock(); }
+};
@@ -0,0 +1,67 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#define MSR_LATENCY_BUCKETS 24
+
+class MSR_Metrics
+{   //Counters for the communication with a device.
+    //All counters are lock free atomics updated with relaxed ordering, so they are cheap enough for the hot path.
+    public:
+        struct opcode_metrics
+        {
+            std::atomic<uint64_t> commands;
+            std::atomic<uint64_t> latency_sum; //in us
+            //bucket i counts round trips shorter than 2^i us, the last one everything longer
+            std::atomic<uint64_t> latency[MSR_LATENCY_BUCKETS];
+        };
+        opcode_metrics opcodes[256];
+        std::atomic<uint64_t> bytes_out;
+        std::atomic<uint64_t> bytes_in;
+        std::atomic<uint64_t> retries;
+        std::atomic<uint64_t> timeouts;
+        std::atomic<uint64_t> busy;
+        std::atomic<uint64_t> crc_failures;
+        std::atomic<uint64_t> baud_changes;
+        std::atomic<uint64_t> live_page_retries; //live page reads thrown away, as the page changed while it was read
+        std::atomic<uint64_t> wire_time; //us spend waiting for the device
+        std::atomic<uint64_t> pacing_time; //us spend waiting between commands
+        std::atomic<uint64_t> decode_time; //us spend decoding and formatting samples
+
+        MSR_Metrics() { reset(); }
+        void reset();
+        void add_round_trip(uint8_t opcode, uint64_t latency);
+        uint64_t get_latency_percentile(uint8_t opcode, double percentile); //upper bound of the bucket, in us
+        uint64_t get_total_commands(); //answered commands of all opcodes
+        std::string report();
+        //Prometheus text format of the counters of many devices, each given with its labels, e.g. serial="12345".
+        //Only reads the counters, so it never talks to the devices.
+        static std::string prometheus(const std::vector<std::pair<std::string, MSR_Metrics *> > &devices);
+};
+
+class MSR_ScopedTimer
+{   //Adds the lifetime of the object in us to counter
+    protected:
+        std::atomic<uint64_t> &counter;
+        std::chrono::steady_clock::time_point start;
+    public:
+        MSR_ScopedTimer(std::atomic<uint64_t> &_counter) : counter(_counter), start(std::chrono::steady_clock::now()) {}
+        ~MSR_ScopedTimer()
+        {
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            counter.fetch_add(elapsed.count(), std::memory_order_relaxed);
+        }
+};
@@ -0,0 +1,116 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "libmsr145_enums.hpp"
+#include "libmsr145_structs.hpp"
+#include "libmsr145_lock.hpp"
+
+#define MSR_REACTOR_LOCK_POLL std::chrono::milliseconds(2) //how often a device used by another thread is tried again
+#define MSR_REACTOR_MAX_EVENTS 64
+
+struct reactor_status
+{
+    bool recording;
+    uint16_t end_address; //address of the last written page
+};
+
+struct reactor_stats
+{
+    uint64_t polls = 0; //sensor and status polls started
+    uint64_t answers = 0;
+    uint64_t timeouts = 0; //polls which got no answer after all retries
+    uint64_t errors = 0; //polls answered busy after all retries, or failed in the port
+    uint64_t skipped = 0; //polls dropped because the previous one of the same kind had not finished yet
+};
+
+class MSR_Base;
+
+class DeviceReactor
+{   //Polls the sensors and the status of many devices from one thread.
+    //The devices are waited on with one epoll and a state machine per device, so no thread is blocked waiting
+    //for an answer. The commands are send through the steps of MSR_Base::send_command, so they get the same
+    //pacing, timeouts, retries and metrics as any other command, and the devices can still be used by other
+    //threads: the reactor takes the session of a device for each command with its priority, without waiting.
+    //Each device has one command in flight at most, and a poll is skipped if the previous poll of the same kind
+    //hasn't finished (backpressure). The transport of the device must have a file descriptor, so serial ports
+    //and TCP can be added, but not replays and captures.
+    public:
+        typedef std::function<void(size_t device, const std::vector<int16_t> &values)> sensor_callback_t;
+        typedef std::function<void(size_t device, const reactor_status &status)> status_callback_t;
+        typedef std::function<void(size_t device, const std::string &error)> error_callback_t;
+    protected:
+        typedef std::chrono::steady_clock clock;
+        enum job_type { no_job, sensor_job, status_job };
+        enum step_type { idle, wait_lock, wait_send, wait_answer, backoff };
+        struct device_state
+        {
+            MSR_Base &device;
+            std::vector<sampletype> types;
+            std::chrono::microseconds sensor_interval;
+            std::chrono::microseconds status_interval;
+            clock::time_point next_sensor = clock::time_point::max(); //when the next poll is due, max if never
+            clock::time_point next_status = clock::time_point::max();
+            bool sensor_pending = false;
+            bool status_pending = false;
+            job_type job = no_job;
+            step_type step = idle;
+            clock::time_point wake; //when the step must be looked at again, if there is no event before
+            uint64_t ticket = MSR_NO_TICKET; //our place in line for the session of the device
+            size_t chunk = 0; //index of the first type in the sensor command in flight
+            std::vector<int16_t> values;
+            uint8_t command[7];
+            uint8_t answer[8];
+            command_state state;
+            reactor_stats stats;
+            device_state(MSR_Base &_device) : device(_device) {}
+        };
+        int epoll_fd = -1;
+        int stop_fd = -1; //eventfd written by stop, so a waiting run wakes up
+        std::atomic<bool> stopping;
+        bool finishing = false; //no new commands are started, run returns when the ones in flight are done
+        int priority;
+        std::vector<std::unique_ptr<device_state> > devices;
+        sensor_callback_t sensor_callback;
+        status_callback_t status_callback;
+        error_callback_t error_callback;
+        virtual void schedule(device_state &device, clock::time_point now);
+        virtual bool start_job(device_state &device);
+        virtual void prepare_command(device_state &device);
+        virtual void advance(size_t id);
+        virtual void finish_command(size_t id);
+        virtual void finish_job(device_state &device);
+        virtual void report_error(size_t id, const std::string &error);
+        virtual void run_until(clock::time_point end);
+    public:
+        DeviceReactor(int _priority = command_priority::live);
+        virtual ~DeviceReactor();
+        //Adds a device, and returns its id which is given to the callbacks. Must be called before run, and the device
+        //must be kept open while the reactor runs. The sensor values are read from the types in the given order every
+        //sensor_interval. An interval of 0 disables the polling. Throws std::invalid_argument if the transport of the
+        //device has no file descriptor.
+        virtual size_t add_device(MSR_Base &device, std::vector<sampletype> types, std::chrono::microseconds sensor_interval,
+            std::chrono::microseconds status_interval = std::chrono::microseconds(0));
+        //The callbacks are called from the thread running the reactor, and must not throw
+        virtual void on_sensor_data(sensor_callback_t callback) { sensor_callback = callback; }
+        virtual void on_status(status_callback_t callback) { status_callback = callback; }
+        virtual void on_error(error_callback_t callback) { error_callback = callback; }
+        virtual void run(); //runs until stop is called
+        virtual void run_for(std::chrono::microseconds duration);
+        //May be called from any thread. run returns when the commands in flight are done, and can't be run again.
+        virtual void stop();
+        virtual const reactor_stats &get_stats(size_t id) { return devices[id]->stats; }
+        virtual size_t get_device_count() { return devices.size(); }
+};
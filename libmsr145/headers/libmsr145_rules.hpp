@@ -0,0 +1,98 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "libmsr145_enums.hpp"
+#include "libmsr145_structs.hpp"
+#include "libmsr145_livestream.hpp"
+
+#define MSR_RULE_CHANNELS 16 //sampletypes below timestamp
+#define MSR_RULE_CHUNK 1024 //samples evaluated at a time
+#define MSR_TICKS_PER_SECOND 512 //the unit of the timestamps, as in the recordings
+
+enum class rule_kind
+{
+    limit, //the condition of a limit_setting, on limit1 and limit2
+    rate_of_change, //the value changes faster than max_rate between two samples
+};
+
+struct msr_rule
+{   //Values and limits are raw, as returned by the device (see MSRTool::convert_from_unit)
+    sampletype type;
+    rule_kind kind = rule_kind::limit;
+    limit_setting mode = no_limit; //one of the rec_ or alarm_ settings
+    int16_t limit1 = 0;
+    int16_t limit2 = 0;
+    uint32_t max_rate = 0; //raw units per second, for rate_of_change
+    uint64_t min_duration = 0; //ticks the condition must hold before the rule fires
+    std::string name;
+};
+
+struct rule_event
+{
+    size_t rule; //index in the rules given to the engine
+    bool active; //true when the rule fires, false when its condition stops holding
+    sampletype type;
+    int16_t value;
+    uint64_t timestamp; //ticks, of the sample which changed the state
+};
+
+class MSR_RuleEngine
+{   //Evaluates limit, rate of change and sustained duration rules on the host, for the channels and limit settings
+    //the device doesn't support. The limit modes are those of set_limit: S<L1, S>L1, S<L2, S>L2, L1<S<L2,
+    //S<L1 or S>L2, and the start/stop hysteresis of rec_start_*.
+    //Samples are evaluated a column (one channel) at a time: the condition of a whole chunk is computed in loops
+    //the compiler can vectorize, and the chunk is only walked sample by sample if the state of the rule changes.
+    //The callback is called from the evaluating thread as soon as a rule changes state. Within a batch of samples
+    //the events are in time order for each channel, but not between channels.
+    protected:
+        struct rule_state
+        {
+            bool condition = false;
+            bool active = false;
+            uint64_t since = 0; //timestamp when the condition started holding
+            bool have_last = false; //the last value, for rate_of_change
+            int16_t last_value = 0;
+            uint64_t last_time = 0;
+        };
+        struct column
+        {   //samples of one channel gathered from a batch
+            size_t count = 0;
+            int16_t values[MSR_RULE_CHUNK];
+            uint64_t timestamps[MSR_RULE_CHUNK];
+        };
+        std::vector<msr_rule> rules;
+        std::vector<rule_state> states;
+        std::vector<size_t> by_type[MSR_RULE_CHANNELS];
+        std::vector<column> columns;
+        std::function<void(const rule_event &event)> callback;
+        uint64_t evaluated = 0;
+        uint64_t events = 0;
+        virtual void evaluate_rule(size_t index, const int16_t *values, const uint64_t *timestamps, size_t count);
+        virtual void flush(sampletype type);
+    public:
+        MSR_RuleEngine(const std::vector<msr_rule> &_rules, std::function<void(const rule_event &event)> _callback);
+        virtual ~MSR_RuleEngine() {}
+        //One channel, in time order
+        virtual void evaluate(sampletype type, const int16_t *values, const uint64_t *timestamps, size_t count);
+        //Decoded samples, e.g. from get_samples or get_new_samples
+        virtual void evaluate(const std::vector<sample> &samples);
+        //A reading of a LiveStream, whose values are in the order of types. The steady clock is used as timestamp.
+        virtual void evaluate(const live_reading &reading, const sampletype *types);
+        virtual void reset(); //forgets the state of the rules, e.g. before the next recording
+        virtual bool is_active(size_t rule) { return states.at(rule).active; }
+        virtual uint64_t get_evaluated() { return evaluated; } //samples evaluated against at least one rule
+        virtual uint64_t get_events() { return events; }
+        //The rule the device applies for a limit entry, with the alarm or the record setting
+        static msr_rule from_limit(const limit_entry &limit, bool alarm);
+};
@@ -0,0 +1,175 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+//Layout of the shared memory segments written by MSR_ShmPublisher, and a reader for them.
+//The reader is header-only, so other programs can use it without linking libmsr145 (only -lrt on old glibc).
+//The publisher is part of libmsr145.
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "libmsr145_enums.hpp"
+
+#define MSR_SHM_MAGIC 0x4D535231 //"MSR1"
+#define MSR_SHM_VERSION 1
+#define MSR_SHM_CHANNELS 16 //one for each sampletype below timestamp
+#define MSR_SHM_PREFIX "/msr145-" //followed by the serial number
+
+struct msr_shm_channel
+{   //Latest value of one sampletype. sequence is odd while the publisher writes the channel (a seqlock).
+    //The fields are atomics, so reading them during a write is not a data race. The reader throws away what it got
+    //if the sequence changed meanwhile.
+    alignas(64) std::atomic<uint32_t> sequence;
+    std::atomic<int16_t> value; //raw, as returned by get_sensor_data
+    std::atomic<int64_t> time_ns; //CLOCK_REALTIME of the reading, 0 if the channel was never published
+    std::atomic<uint64_t> updates;
+};
+
+struct msr_shm_segment
+{
+    std::atomic<uint32_t> magic; //set last when the publisher creates the segment
+    uint32_t version;
+    char serial[32];
+    std::atomic<int32_t> publisher_pid; //0 after the publisher has stopped
+    msr_shm_channel channels[MSR_SHM_CHANNELS];
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+    "The shared memory segment needs lock free atomics, which work between processes");
+
+struct shm_reading
+{
+    int16_t value;
+    std::chrono::system_clock::time_point time;
+    uint64_t updates; //how often the channel has been published, so a consumer can tell if it missed any
+};
+
+inline bool msr_shm_try_read(const msr_shm_channel &channel, shm_reading &reading)
+{   //One attempt at reading a consistent value
+    uint32_t sequence = channel.sequence.load(std::memory_order_acquire);
+    if(sequence & 1) return false;
+    int16_t value = channel.value.load(std::memory_order_relaxed);
+    int64_t time_ns = channel.time_ns.load(std::memory_order_relaxed);
+    uint64_t updates = channel.updates.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(channel.sequence.load(std::memory_order_relaxed) != sequence || time_ns == 0) return false;
+    reading.value = value;
+    reading.time = std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(time_ns)));
+    reading.updates = updates;
+    return true;
+}
+
+class MSR_ShmReader
+{   //Maps the segment of a device read-only. Reads never block the publisher or each other.
+    protected:
+        int fd = -1;
+        void *map = nullptr;
+        const msr_shm_segment *segment = nullptr;
+        MSR_ShmReader(const MSR_ShmReader &) = delete;
+        MSR_ShmReader &operator=(const MSR_ShmReader &) = delete;
+    public:
+        //name is either the serial number of the device, or the full segment name starting with /
+        MSR_ShmReader(const std::string &name)
+        {
+            std::string shm_name = name.size() && name[0] == '/' ? name : MSR_SHM_PREFIX + name;
+            fd = shm_open(shm_name.c_str(), O_RDONLY, 0);
+            if(fd < 0)
+                throw std::runtime_error("Could not open the shared memory segment " + shm_name);
+            struct stat st;
+            if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(msr_shm_segment))
+            {
+                close(fd);
+                throw std::runtime_error("The shared memory segment " + shm_name + " is too small");
+            }
+            map = mmap(nullptr, sizeof(msr_shm_segment), PROT_READ, MAP_SHARED, fd, 0);
+            if(map == MAP_FAILED)
+            {
+                close(fd);
+                throw std::runtime_error("Could not map the shared memory segment " + shm_name);
+            }
+            segment = static_cast<const msr_shm_segment *>(map);
+            if(segment->magic.load(std::memory_order_acquire) != MSR_SHM_MAGIC || segment->version != MSR_SHM_VERSION)
+            {
+                munmap(map, sizeof(msr_shm_segment));
+                close(fd);
+                throw std::runtime_error("The shared memory segment " + shm_name + " is not an MSR145 segment of version "
+                    + std::to_string(MSR_SHM_VERSION));
+            }
+        }
+        ~MSR_ShmReader()
+        {
+            munmap(map, sizeof(msr_shm_segment));
+            close(fd);
+        }
+        //A single attempt, so it is wait-free. Returns false if the channel was being written or was never published.
+        bool try_read(sampletype type, shm_reading &reading) const
+        {
+            if((unsigned)type >= MSR_SHM_CHANNELS) return false;
+            return msr_shm_try_read(segment->channels[type], reading);
+        }
+        //Retries while the channel is being written, which takes the publisher a few stores.
+        //Returns false only if the channel was never published.
+        bool read(sampletype type, shm_reading &reading) const
+        {
+            while(!try_read(type, reading))
+                if((unsigned)type >= MSR_SHM_CHANNELS || segment->channels[type].time_ns.load(std::memory_order_relaxed) == 0)
+                    return false;
+            return true;
+        }
+        std::string get_serial() const { return std::string(segment->serial); }
+        bool publisher_running() const { return segment->publisher_pid.load(std::memory_order_relaxed) != 0; }
+};
+
+class MSR_Reader;
+
+class MSR_ShmPublisher
+{   //Creates the segment of a device (MSR_SHM_PREFIX + serial unless a name is given), and writes the latest sensor
+    //values to it. With a non-zero interval the given sensors are read at that rate in a thread of its own, with
+    //command_priority::live. Values read elsewhere can be given to publish, e.g. by a daemon serving other clients.
+    //The segment is removed again when the publisher is deleted.
+    protected:
+        MSR_Reader &device;
+        std::vector<sampletype> types;
+        std::chrono::microseconds interval;
+        std::string shm_name;
+        int fd = -1;
+        msr_shm_segment *segment = nullptr;
+        std::mutex publish_mutex; //one writer at a time, the readers don't take it
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable stop_requested;
+        bool running = false;
+        std::atomic<uint64_t> errors;
+        virtual void poll();
+    public:
+        MSR_ShmPublisher(MSR_Reader &_device, const std::vector<sampletype> &_types,
+            std::chrono::microseconds _interval, std::string name = "");
+        virtual ~MSR_ShmPublisher();
+        virtual void start();
+        virtual void stop();
+        virtual void publish(const sampletype *sample_types, size_t count, const int16_t *values,
+            std::chrono::system_clock::time_point time = std::chrono::system_clock::now());
+        //The last published value of type, false if there is none
+        virtual bool get_latest(sampletype type, shm_reading &reading);
+        virtual std::string get_name() { return shm_name; }
+        virtual uint64_t get_errors() { return errors; } //reads which failed, because the device didn't answer or the port failed
+        virtual void count_error() { errors++; } //for the failed reads of values which are given to publish
+};
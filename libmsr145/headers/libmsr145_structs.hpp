@@ -1,5 +1,10 @@
 #pragma once
+#include <chrono>
 #include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <boost/optional.hpp>
 #include "libmsr145_enums.hpp"
 struct rec_entry
 {
@@ -15,4 +20,141 @@ struct sample
     int16_t value;
     uint64_t timestamp; //this is the time since the start of the recording in 1/512 seconds
     uint32_t rawsample; //for debugging
+    //position in the flash: address of the page and index of the 4 byte word in the page
+    uint16_t address;
+    uint16_t word;
+};
+
+struct raw_page
+{   //The sample words of one page of a recording
+    uint16_t address; //flash address of the page
+    uint16_t first_word; //index in the page of the first word in data
+    uint64_t timestamp; //timestamp in the page header
+    std::vector<uint8_t> data;
+};
+
+struct timer_setting
+{
+    uint32_t interval; //in 1/512 seconds
+    uint8_t measurements; //bitmask of active_measurement
+    bool blink;
+};
+
+struct limit_entry
+{
+    sampletype type;
+    uint8_t rec_settings;
+    uint8_t alarm_settings;
+    uint16_t limit1;
+    uint16_t limit2;
+};
+
+struct calibration_points
+{
+    uint16_t point_1_target;
+    uint16_t point_1_actual;
+    uint16_t point_2_target;
+    uint16_t point_2_actual;
+};
+
+struct live_page
+{   //A consistent read of the page the device is currently recording to
+    bool recording = false; //if not, nothing else is set
+    uint16_t address = 0; //the address the page will have in the flash when it is completed
+    uint16_t length = 0; //number of bytes written to the page
+    uint64_t page_time = 0; //timestamp in the page header
+    unsigned retries = 0; //reads thrown away, as the page was completed or changed while it was read
+    std::vector<uint8_t> data; //answer to the live page command, the page is in data[1] to data[length]. Empty if not fetched.
+};
+
+struct follow_cursor
+{   //How far get_new_samples has come in a recording. Start with a default constructed cursor.
+    bool started = false;
+    bool finished = false; //the recording has stopped, and all of its samples have been returned
+    uint16_t address = 0; //address of the page the next sample is in
+    uint16_t offset = 0; //position of the next sample in the page
+    uint64_t page_time = 0; //timestamp in the header of that page, 0 until it has been read
+    uint64_t start_time = 0; //start of the recording, sample timestamps are relative to this
+    uint64_t timestamp = 0; //timestamp of the last sample
+};
+
+struct fresh_sensor_data
+{
+    std::vector<int16_t> values;
+    //time in us from the conversion was triggered until the value changed. -1 if it didn't change.
+    std::vector<int64_t> latency;
+};
+
+struct pacing_entry
+{
+    uint8_t opcode;
+    uint32_t gap; //time in us waited after a command with this opcode before the next command is send
+    uint64_t sent; //commands send with this opcode
+    uint64_t busy; //busy (0x20) answers to commands with this opcode
+    uint64_t timeouts; //timeouts of commands with this opcode
+};
+
+struct DeviceSnapshot
+{   //All the settings of a device, read in one pass by MSR_Reader::get_snapshot
+    std::string serial;
+    std::string name;
+    int firmware_major;
+    int firmware_minor;
+    struct tm device_time;
+    bool recording;
+    bool marker_on;
+    bool alarm_confirm_on;
+    timer_setting timers[8];
+    bool bufferon;
+    startcondition start;
+    struct tm start_time;
+    struct tm end_time;
+    uint16_t active_limits; //bitmask, (active_limits & (1 << sampletype))
+    std::vector<limit_entry> limits;
+    std::string calibration_name;
+    uint8_t calibration_year; //years since 2000
+    uint8_t calibration_month; //0 = january
+    uint8_t calibration_day; //0 = 1th
+    uint8_t active_calibrations; //bitmask of active_calibrations
+    calibration_points humidity_calibration;
+    calibration_points temperature_calibration;
+    std::string L1_unit;
+    float L1_offset;
+    float L1_gain;
+    std::vector<sampletype> sensor_types;
+    std::vector<int16_t> sensor_values; //raw readings, in the same order as sensor_types
+};
+
+struct DeviceConfig
+{   //The wanted settings of a device, written by MSR_Writer::apply.
+    //Fields which are not set are left as they are on the device.
+    boost::optional<std::string> name;
+    boost::optional<std::string> calibration_name;
+    boost::optional<uint8_t> calibration_year; //years since 2000
+    boost::optional<uint8_t> calibration_month; //0 = january
+    boost::optional<uint8_t> calibration_day; //0 = 1th
+    boost::optional<uint8_t> active_calibrations;
+    boost::optional<timer_setting> timers[8];
+    boost::optional<bool> marker_on;
+    boost::optional<bool> alarm_confirm_on;
+    std::vector<limit_entry> limits; //types not in the list are left as they are
+    boost::optional<calibration_points> humidity_calibration;
+    boost::optional<calibration_points> temperature_calibration;
+    boost::optional<std::string> L1_unit;
+    boost::optional<float> L1_offset;
+    boost::optional<float> L1_gain;
+    boost::optional<struct tm> start_time;
+    boost::optional<struct tm> end_time;
+};
+
+struct command_state
+{   //A command send through the steps of MSR_Base::send_command, see MSR_Base::begin_attempt
+    uint8_t *command = nullptr;
+    size_t command_length = 0;
+    uint8_t *out = nullptr; //the answer
+    size_t out_length = 0;
+    unsigned attempt = 0; //0 for the first attempt
+    size_t received = 0; //bytes of the answer read in this attempt
+    std::chrono::steady_clock::time_point start; //when this attempt was send
+    std::chrono::steady_clock::time_point deadline; //when this attempt has timed out
 };
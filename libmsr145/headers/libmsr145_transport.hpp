@@ -0,0 +1,157 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+#include <boost/asio.hpp>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <deque>
+#include <functional>
+
+#define MSR_BUAD_RATE 9600
+#define MSR_STOP_BITS boost::asio::serial_port_base::stop_bits::one
+#define MSR_WORD_length 8
+
+
+class MSR_Transport
+{   //The link to the device. MSR_Base only talks to the device through this.
+    public:
+        virtual ~MSR_Transport() {}
+        virtual void write(const uint8_t *data, size_t length) = 0;
+        //Reads length bytes into data. Returns the number of bytes read before time_out.
+        virtual size_t read(uint8_t *data, size_t length, boost::posix_time::time_duration time_out) = 0;
+        virtual void set_baud(uint32_t baudrate) = 0;
+        //false if the transport can't follow a baudrate change of the device, in which case it's kept at 9600
+        virtual bool can_set_baud() { return true; }
+        //throw away any bytes received but not read yet
+        virtual void drain() {}
+        //For waiting on many transports from one thread, see DeviceReactor.
+        //get_fd is the file descriptor which becomes readable when bytes are received, -1 if there is none.
+        //read_some reads up to length bytes which have already been received, without waiting.
+        //flush sends what has been written, as transports may hold it back until the next read.
+        virtual int get_fd() { return -1; }
+        virtual size_t read_some(__attribute__((unused)) uint8_t *data, __attribute__((unused)) size_t length) { return 0; }
+        virtual void flush() {}
+        //added to the timeout of every command, e.g. to cover a network
+        virtual boost::posix_time::time_duration get_latency() { return boost::posix_time::seconds(0); }
+};
+
+class MSR_SerialTransport : public MSR_Transport
+{
+    protected:
+        boost::asio::io_service ioservice;
+        boost::asio::serial_port *port;
+    public:
+        MSR_SerialTransport(std::string portname);
+        virtual ~MSR_SerialTransport();
+        virtual void write(const uint8_t *data, size_t length);
+        virtual size_t read(uint8_t *data, size_t length, boost::posix_time::time_duration time_out);
+        virtual void set_baud(uint32_t baudrate);
+        virtual void drain();
+        virtual int get_fd() { return port->native_handle(); }
+        virtual size_t read_some(uint8_t *data, size_t length);
+};
+
+class MSR_TcpTransport : public MSR_Transport
+{   //For devices attached to a network serial server (e.g. ser2net in raw mode).
+    //Nagle is turned off, and the bytes written before a read are send as one segment.
+    //The server keeps its own baudrate, so baudrate changes are not supported.
+    protected:
+        boost::asio::io_service ioservice;
+        boost::asio::ip::tcp::socket *socket;
+        std::vector<uint8_t> pending;
+        boost::posix_time::time_duration extra_timeout; //added to every timeout to cover the network
+    public:
+        MSR_TcpTransport(std::string host, std::string port,
+            boost::posix_time::time_duration _extra_timeout = boost::posix_time::milliseconds(200));
+        virtual ~MSR_TcpTransport();
+        virtual void write(const uint8_t *data, size_t length);
+        virtual size_t read(uint8_t *data, size_t length, boost::posix_time::time_duration time_out);
+        virtual void set_baud(uint32_t baudrate);
+        virtual bool can_set_baud() { return false; }
+        virtual void drain();
+        virtual int get_fd() { return socket->native_handle(); }
+        virtual size_t read_some(uint8_t *data, size_t length);
+        virtual void flush();
+        virtual boost::posix_time::time_duration get_latency() { return extra_timeout; }
+};
+
+class MSR_MemoryTransport : public MSR_Transport
+{   //In-memory loopback. Every written frame is given to the responder, and the bytes it returns
+    //are what the following reads return. Reads never wait, so it is useful for benchmarks.
+    public:
+        typedef std::function<std::vector<uint8_t>(const std::vector<uint8_t> &frame)> responder_t;
+    protected:
+        responder_t responder;
+        std::deque<uint8_t> received;
+    public:
+        MSR_MemoryTransport(responder_t _responder) : responder(_responder) {}
+        virtual void write(const uint8_t *data, size_t length);
+        virtual size_t read(uint8_t *data, size_t length, boost::posix_time::time_duration time_out);
+        virtual void set_baud(__attribute__((unused)) uint32_t baudrate) {}
+        virtual void drain() { received.clear(); }
+};
+
+class MSR_CaptureTransport : public MSR_Transport
+{   //Passes everything on to another transport, and records it to a trace file.
+    //Each line in the trace is one event:
+    //W <time in us> <bytes written in hex>
+    //R <time in us> <bytes requested> <bytes read in hex>
+    //B <time in us> <baudrate>
+    protected:
+        MSR_Transport *transport;
+        std::ofstream trace;
+        std::chrono::steady_clock::time_point start;
+        virtual void write_event(char type, const std::string &args, const uint8_t *data, size_t length);
+    public:
+        MSR_CaptureTransport(MSR_Transport *_transport, std::string filename); //takes ownership of _transport
+        virtual ~MSR_CaptureTransport();
+        virtual void write(const uint8_t *data, size_t length);
+        virtual size_t read(uint8_t *data, size_t length, boost::posix_time::time_duration time_out);
+        virtual void set_baud(uint32_t baudrate);
+        virtual bool can_set_baud() { return transport->can_set_baud(); }
+        virtual void drain() { transport->drain(); }
+        virtual void flush() { transport->flush(); }
+        virtual boost::posix_time::time_duration get_latency() { return transport->get_latency(); }
+};
+
+class MSR_ReplayTransport : public MSR_Transport
+{   //Plays back a trace recorded by MSR_CaptureTransport.
+    //Writes must match the trace byte for byte, else a std::runtime_error is thrown.
+    //If realtime is set, reads are delayed to the time they had in the recording.
+    protected:
+        struct trace_event
+        {
+            char type;
+            uint64_t time; //us since start of the trace
+            uint32_t value; //requested length for reads, baudrate for baud changes
+            std::vector<uint8_t> data;
+        };
+        std::vector<trace_event> events;
+        size_t next_event = 0;
+        bool realtime;
+        std::chrono::steady_clock::time_point start;
+        virtual trace_event &get_event(char type);
+    public:
+        MSR_ReplayTransport(std::string filename, bool _realtime = false);
+        virtual void write(const uint8_t *data, size_t length);
+        virtual size_t read(uint8_t *data, size_t length, boost::posix_time::time_duration time_out);
+        virtual void set_baud(uint32_t baudrate);
+};
+
+//Opens the transport described by name.
+//"tcp:<host>:<port>" connects to a network serial server.
+//"replay:<file>" replays a trace as fast as possible, "replay-rt:<file>" replays it in recorded time.
+//Anything else is opened as a serial port.
+MSR_Transport *open_transport(std::string name);
+
+//Expands shell wildcards (e.g. /dev/ttyUSB*) in the given port names. Names without matches are kept as they are.
+std::vector<std::string> expand_port_patterns(const std::vector<std::string> &patterns);
@@ -0,0 +1,45 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "libmsr145_enums.hpp"
+
+#define MSR_UNIT_TABLE_SIZE 65536
+
+struct unit_conversion
+{   //From raw sample values to units: value * scale + offset, or table[(uint16_t)value] if there is a table.
+    //The product is rounded to float before the offset is added, as convert_to_unit always did.
+    double scale = 1;
+    float offset = 0;
+    std::shared_ptr<const std::vector<float> > table; //MSR_UNIT_TABLE_SIZE entries
+};
+
+//The factor from raw values of type to its unit (mbar, C, %, V, lux).
+//Throws std::invalid_argument for types without a unit.
+double msr_unit_scale(sampletype type);
+//The conversion of type to its unit. A non-zero conversion_factor replaces the factor of the type, e.g. the L1 gain,
+//and offset is added, e.g. the L1 offset.
+unit_conversion msr_unit_conversion(sampletype type, float conversion_factor = 0, float offset = 0);
+//A conversion through a table of all 65536 raw values, for mappings which aren't linear, e.g. calibration curves.
+//Building it costs 65536 calls of mapping, so it pays for itself on long columns.
+unit_conversion msr_unit_table(const std::function<float(int16_t value)> &mapping);
+
+//Converts a whole column of one type. The linear loops have no branches, so the compiler vectorizes them.
+void msr_convert_column(const unit_conversion &conversion, const int16_t *values, size_t count, float *out);
+void msr_convert_column(const unit_conversion &conversion, const int16_t *values, size_t count, double *out);
+
+inline float msr_convert_value(const unit_conversion &conversion, int16_t value)
+{
+    if(conversion.table) return (*conversion.table)[(uint16_t)value];
+    return (float)(value * conversion.scale) + conversion.offset;
+}
@@ -13,12 +13,13 @@
 #include <cstdio>
 #include <chrono>
 #include <thread> //sleep_for
-#include <boost/optional.hpp>
-#include <boost/system/error_code.hpp>
 #include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <cstdlib>
 using namespace boost::asio;
 using namespace boost::posix_time;
 
+thread_local int MSR_Base::thread_priority = command_priority::normal;
 
 //sends the given command to the MSR145 and read out_length number of bytes from it into out
 uint8_t MSR_Base::calc_chksum(uint8_t *data, size_t length)
@@ -29,69 +30,249 @@ uint8_t MSR_Base::calc_chksum(uint8_t *data, size_t length)
     return crc.checksum();
 }
 
-int MSR_Base::send_with_timeout(uint8_t *command, size_t command_length,
-                            __attribute__((unused)) uint8_t *out, __attribute__((unused)) size_t out_length, time_duration time_out)
-{
-    //zero out output.
-    memset(out, 0, out_length);
-    auto checksum = calc_chksum(command, command_length);
-    write(*(this->port), buffer(command, command_length));
-    write(*(this->port), buffer(&checksum, sizeof(checksum)));
-    boost::optional<boost::system::error_code> timer_result;
-    boost::asio::deadline_timer timer(this->port->get_io_service());
-    timer.expires_from_now(time_out);
-    timer.async_wait([&timer_result] (const boost::system::error_code& error) { timer_result.reset(error); });
-
-    boost::optional<boost::system::error_code> read_result;
-    boost::asio::async_read(*(this->port), buffer(out, out_length), transfer_exactly(out_length), [&read_result] (const boost::system::error_code& error, size_t) { read_result.reset(error); });
-
-    this->port->get_io_service().reset();
-    bool success = false;
-    while (this->port->get_io_service().run_one())
+void MSR_Base::write_frame(uint8_t *command, size_t command_length)
+{   //send the command and checksum as one frame. Commands are 7 bytes, so we don't need to allocate for them.
+    uint8_t small_frame[16];
+    std::vector<uint8_t> large_frame;
+    uint8_t *frame = small_frame;
+    if(command_length + 1 > sizeof(small_frame))
     {
-        if (read_result)
-        {
-            timer.cancel();
-            success = true;
-        }
-        else if (timer_result)
-        {
-            this->port->cancel();
-            success = false;
-        }
-    }
-    if(success == false)
-        return 1;
-    else if(out_length == 0) return 0;
-    for(size_t i = 0; i < out_length; i++)
-    {
-        if(out[i] != 0) return 0;
+        large_frame.resize(command_length + 1);
+        frame = large_frame.data();
     }
-    return 1;
+    memcpy(frame, command, command_length);
+    frame[command_length] = calc_chksum(command, command_length);
+    this->transport->write(frame, command_length + 1);
+    this->transport->flush();
 }
 
 int MSR_Base::send_command(uint8_t *command, size_t command_length,
                             uint8_t *out, size_t out_length)
     //Returns 0 on success
 {
-    int returncode = 0;
-    bool selfalloced = false;
+    //the answer is read before the lock is released, so answers can't be mixed up between threads
+    MSR_PriorityGuard guard(port_lock, thread_priority);
+    std::vector<uint8_t> own_out;
     if(out == nullptr && out_length > 0)
     {
-        selfalloced = true;
-        out = new uint8_t[out_length];
+        own_out.resize(out_length);
+        out = own_out.data();
     }
     //printf("SEND: ");    for(size_t i = 0; i < command_length; i++) printf("%02X ", command[i]); printf("\n");
-    int error;
-    do {
-        error = send_with_timeout(command, command_length, out, out_length, time_duration(0,0,1,0));
-    } while(error != 0);
+    command_state state;
+    state.command = command;
+    state.command_length = command_length;
+    state.out = out;
+    state.out_length = out_length;
+    while(true)
+    {
+        {
+            MSR_ScopedTimer pacing_timer(metrics.pacing_time);
+            wait_for_pacing();
+        }
+        begin_attempt(state);
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(state.deadline - std::chrono::steady_clock::now());
+        state.received += this->transport->read(out + state.received, out_length - state.received,
+            microseconds(std::max<int64_t>(remaining.count(), 0)));
+        auto result = end_attempt(state);
+        if(result == command_result::done) break;
+        if(result == command_result::recover) recover(state.attempt);
+        state.attempt++;
+    }
 
     //printf("RECIEVE: ");    for(size_t i = 0; i < out_length; i++) printf("%02X ", out[i]); printf("\n\n");
-    if(out_length && (out[0] & 0x20) ) returncode = 1; // if response hav   e 0x20 set, it means error (normaly because it didn't have time to respond).
-    //if(out_length > 2 && (out[0] == 0x00) &&  ) assert(false); //this should not happen.
-    if(selfalloced) delete[] out;
-    return returncode;
+    // if response have 0x20 set, it means error (normaly because it didn't have time to respond).
+    return out_length && (out[0] & 0x20) ? 1 : 0;
+}
+
+std::chrono::steady_clock::time_point MSR_Base::get_send_time()
+{
+    return last_command_end + std::chrono::microseconds(pacing_gap[last_opcode]);
+}
+
+void MSR_Base::begin_attempt(command_state &state)
+{   //Sends the command. The timeout is doubled for each failed attempt.
+    if(baud_reset_pending)
+    {   //the pacing gap after the baudrate command of reset_link has passed, so the transport can follow now
+        baud_reset_pending = false;
+        this->transport->set_baud(MSR_BUAD_RATE);
+        cur_baud = MSR_BUAD_RATE;
+        metrics.baud_changes.fetch_add(1, std::memory_order_relaxed);
+        this->transport->drain();
+    }
+    if(state.attempt) metrics.retries.fetch_add(1, std::memory_order_relaxed);
+    auto time_out = get_timeout(state.command[0], state.command_length, state.out_length) * (1 << std::min(state.attempt, 3u))
+        + this->transport->get_latency();
+    if(state.out_length) memset(state.out, 0, state.out_length);
+    state.received = 0;
+    state.start = std::chrono::steady_clock::now();
+    state.deadline = state.start + std::chrono::microseconds(time_out.total_microseconds());
+    write_frame(state.command, state.command_length);
+}
+
+bool MSR_Base::receive(command_state &state)
+{   //Reads what has arrived of the answer, without waiting. Returns true when all of it is there.
+    if(state.received < state.out_length)
+        state.received += this->transport->read_some(state.out + state.received, state.out_length - state.received);
+    return state.received == state.out_length;
+}
+
+command_result::command_result MSR_Base::end_attempt(command_state &state)
+{   //Called when the answer is complete, or the deadline of the attempt has passed
+    uint8_t *command = state.command;
+    uint8_t *out = state.out;
+    size_t out_length = state.out_length;
+    bool success = state.received == out_length;
+    if(success && out_length)
+    {   //an answer of zeros is no answer
+        success = false;
+        for(size_t i = 0; i < out_length; i++)
+            if(out[i] != 0) success = true;
+    }
+    last_command_end = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(last_command_end - state.start);
+    metrics.wire_time.fetch_add(elapsed.count(), std::memory_order_relaxed);
+    metrics.bytes_out.fetch_add(state.command_length + 1, std::memory_order_relaxed);
+    bool busy = success && out_length && (out[0] & 0x20);
+    update_pacing(command[0], busy, !success);
+    if(success)
+    {
+        metrics.bytes_in.fetch_add(out_length, std::memory_order_relaxed);
+        metrics.add_round_trip(command[0], elapsed.count());
+        if(busy) metrics.busy.fetch_add(1, std::memory_order_relaxed);
+        if(out_length > 1 && out[out_length - 1] != calc_chksum(out, out_length - 1))
+            metrics.crc_failures.fetch_add(1, std::memory_order_relaxed);
+        update_rtt(command[0], elapsed.count() - get_wire_time(state.command_length + 1 + out_length));
+        //if the device was busy, try again after the (now larger) gap. If we run out of retries, return the busy answer.
+        return busy && state.attempt < retry_budget ? command_result::retry : command_result::done;
+    }
+    metrics.timeouts.fetch_add(1, std::memory_order_relaxed);
+    if(state.attempt >= retry_budget)
+    {
+        char msg[100];
+        snprintf(msg, sizeof(msg), "No answer from the device on command 0x%02X 0x%02X after %u attempts",
+            command[0], state.command_length > 1 ? command[1] : 0, state.attempt + 1);
+        throw msr_timeout_error(msg, command[0]);
+    }
+    return command_result::recover;
+}
+
+int64_t MSR_Base::get_wire_time(size_t bytes)
+{   //8 data bits, one start and one stop bit
+    return bytes * 10 * 1000000 / cur_baud;
+}
+
+time_duration MSR_Base::get_timeout(uint8_t opcode, size_t command_length, size_t out_length)
+{   //The time it takes to send the command and the response, plus an allowance for the device.
+    //The allowance is learned from the round trip times of earlier commands with the same opcode.
+    int64_t allowance = initial_allowance; //used until the first round trip is measured
+    if(srtt[opcode])
+        allowance = std::max<int64_t>(srtt[opcode] + 4 * rttvar[opcode], 30000);
+    return microseconds(get_wire_time(command_length + 1 + out_length) + allowance);
+}
+
+void MSR_Base::update_rtt(uint8_t opcode, int64_t rtt)
+{
+    rtt = std::max<int64_t>(rtt, 1);
+    if(srtt[opcode] == 0)
+    {
+        srtt[opcode] = rtt;
+        rttvar[opcode] = rtt / 2;
+        return;
+    }
+    rttvar[opcode] = (3 * rttvar[opcode] + std::abs(srtt[opcode] - rtt)) / 4;
+    srtt[opcode] = (7 * srtt[opcode] + rtt) / 8;
+}
+
+void MSR_Base::recover(unsigned attempt)
+{   //Called after a command failed
+    std::this_thread::sleep_for(get_recovery_delay(attempt));
+    reset_link(attempt);
+}
+
+std::chrono::milliseconds MSR_Base::get_recovery_delay(unsigned attempt)
+{   //Back off, so a device which is slow to answer is done before the next attempt
+    return std::chrono::milliseconds(10 << std::min(attempt, 6u));
+}
+
+void MSR_Base::reset_link(unsigned attempt)
+{   //Called after the recovery delay. Throw away anything the device may have send too late.
+    this->transport->drain();
+    if(attempt == 1 && cur_baud != MSR_BUAD_RATE)
+    {   //The device falls back to 9600 by itself when it have been idle, so we may have lost the baudrate.
+        //Tell it to go to 9600 at the current baudrate (this is ignored if it's already there). The transport
+        //follows in the next begin_attempt, as it must wait for the pacing gap after this command.
+        uint8_t command[] = {0x85, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00};
+        write_frame(command, sizeof(command));
+        last_command_end = std::chrono::steady_clock::now();
+        last_opcode = command[0];
+        baud_reset_pending = true;
+    }
+}
+
+void MSR_Base::init_pacing()
+{
+    //The device needs a bit of time after changing baudrate, else it will stall.
+    pacing_gap[0x85] = 20000;
+    pacing_min_gap[0x85] = 5000;
+    last_command_end = std::chrono::steady_clock::now();
+}
+
+void MSR_Base::wait_for_pacing()
+{
+    std::this_thread::sleep_until(get_send_time());
+}
+
+void MSR_Base::update_pacing(uint8_t opcode, bool busy, bool timeout)
+{   //The command with this opcode have just been send. Busy answers and timeouts are blamed
+    //on the gap after the previous command. As the command was not handled, the retry
+    //will wait for the new gap after the previous command.
+    pacing_sent[opcode]++;
+    if(busy) pacing_busy[opcode]++;
+    if(timeout) pacing_timeouts[opcode]++;
+    if(busy || timeout)
+    {
+        pacing_gap[last_opcode] = std::min<int64_t>(pacing_gap[last_opcode] * 2 + 500, 1000000);
+        return;
+    }
+    pacing_gap[last_opcode] = std::max<int64_t>(pacing_gap[last_opcode] - 50, pacing_min_gap[last_opcode]);
+    last_opcode = opcode;
+}
+
+std::vector<pacing_entry> MSR_Base::get_pacing()
+{   //returns the pacing for the opcodes which have been used
+    MSR_PriorityGuard guard(port_lock, thread_priority);
+    std::vector<pacing_entry> pacing;
+    for(int opcode = 0; opcode < 256; opcode++)
+    {
+        if(pacing_sent[opcode] == 0 && pacing_gap[opcode] == 0) continue;
+        pacing_entry entry;
+        entry.opcode = opcode;
+        entry.gap = pacing_gap[opcode];
+        entry.sent = pacing_sent[opcode];
+        entry.busy = pacing_busy[opcode];
+        entry.timeouts = pacing_timeouts[opcode];
+        pacing.push_back(entry);
+    }
+    return pacing;
+}
+
+void MSR_Base::set_pacing_gap(uint8_t opcode, uint32_t gap)
+{
+    MSR_PriorityGuard guard(port_lock, thread_priority);
+    pacing_gap[opcode] = std::max<int64_t>(gap, pacing_min_gap[opcode]);
+}
+
+void MSR_Base::set_initial_timeout(time_duration time_out)
+{
+    MSR_PriorityGuard guard(port_lock, thread_priority);
+    initial_allowance = time_out.total_microseconds();
+}
+
+void MSR_Base::set_retry_budget(unsigned retries)
+{
+    MSR_PriorityGuard guard(port_lock, thread_priority);
+    retry_budget = retries;
 }
 
 void MSR_Base::send_raw(uint8_t *command, size_t command_length,
@@ -103,8 +284,8 @@ void MSR_Base::send_raw(uint8_t *command, size_t command_length,
         selfalloced = true;
         out = new uint8_t[out_length];
     }
-    write(*(this->port), buffer(command, command_length));
-    size_t read_bytes = read(*(this->port), buffer(out, out_length), transfer_exactly(out_length));
+    this->transport->write(command, command_length);
+    size_t read_bytes = this->transport->read(out, out_length, pos_infin);
     assert(read_bytes == out_length);
     assert(out_length == 0 || (out[out_length - 1] == calc_chksum(out, out_length - 1)));
     if(selfalloced) delete[] out;
@@ -113,22 +294,38 @@ void MSR_Base::send_raw(uint8_t *command, size_t command_length,
 
 MSR_Base::MSR_Base(std::string _portname)
 {
-    //open the port and setup baudrate, stop bits and word length
+    //open the port. The transport sets up baudrate, stop bits and word length
     this->portname = _portname;
-    this->port = new serial_port(ioservice, _portname);
-    this->port->set_option(serial_port_base::baud_rate( MSR_BUAD_RATE ));
-    this->port->set_option(serial_port_base::stop_bits( MSR_STOP_BITS ));
-    this->port->set_option(serial_port_base::character_size( MSR_WORD_length ));
-    this->port->set_option(serial_port::flow_control(serial_port::flow_control::none));
+    this->transport = open_transport(_portname);
+    init_pacing();
     //std::this_thread::sleep_for(std::chrono::milliseconds(20)); //We need to sleep a bit.
 
 }
 
+MSR_Base::MSR_Base(MSR_Transport *_transport)
+{
+    this->transport = _transport;
+    init_pacing();
+}
+
 MSR_Base::~MSR_Base()
 {
     //set baud to 9600 so we can open quickly again
-    set_baud(MSR_BUAD_RATE);
-    delete port;
+    try
+    {
+        session_baud = MSR_BUAD_RATE;
+        if(cur_baud != MSR_BUAD_RATE) set_baud(MSR_BUAD_RATE);
+    }
+    catch(std::exception &)
+    {   //the device is gone, nothing to do about it here.
+    }
+    delete transport;
+}
+
+void MSR_Base::start_capture(std::string filename)
+{
+    MSR_PriorityGuard guard(port_lock, thread_priority);
+    this->transport = new MSR_CaptureTransport(this->transport, filename);
 }
 
 void MSR_Base::set_baud(uint32_t baudrate)
@@ -159,11 +356,29 @@ void MSR_Base::set_baud(uint32_t baudrate)
             return;
 
     }
+    if(!this->transport->can_set_baud()) return; //stay at 9600, the device resets to it by itself.
+    //the device and the transport must change baudrate without other commands in between
+    MSR_PriorityGuard guard(port_lock, thread_priority);
+    if(session_baud != MSR_BUAD_RATE)
+    {   //in a session, don't go below the session baudrate, and don't set the baudrate we are already at
+        baudrate = std::max(baudrate, session_baud);
+        if(baudrate == cur_baud) return;
+    }
     uint8_t command[] = {0x85, 0x01, baudbyte, 0x00, 0x00, 0x00, 0x00};
+    //The pacing makes sure we wait a bit before the next command, else we will stall
     this->send_command(command, sizeof(command), nullptr, 0);
-    std::this_thread::sleep_for(std::chrono::milliseconds(20)); //We need to sleep a bit after changeing baud, else we will stall
 
-    this->port->set_option(serial_port_base::baud_rate( baudrate ));
+    this->transport->set_baud(baudrate);
+    cur_baud = baudrate;
+    metrics.baud_changes.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MSR_Base::set_session_baud(uint32_t baudrate)
+{
+    MSR_PriorityGuard guard(port_lock, thread_priority);
+    session_baud = MSR_BUAD_RATE;
+    set_baud(baudrate);
+    if(cur_baud == baudrate) session_baud = baudrate; //not if the baudrate was invalid, or the transport can't change it
 }
 
 
@@ -0,0 +1,105 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "libmsr145.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+MSR_SensorCoalescer::MSR_SensorCoalescer(MSR_Reader &_device, std::chrono::microseconds _window) :
+    device(_device), window(_window)
+{
+    thread = std::thread(&MSR_SensorCoalescer::work, this);
+}
+
+MSR_SensorCoalescer::~MSR_SensorCoalescer()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    thread.join();
+}
+
+std::future<std::vector<int16_t> > MSR_SensorCoalescer::request_sensor_data(const std::vector<sampletype> &types)
+{
+    request new_request;
+    new_request.types = types;
+    auto future = new_request.promise.get_future();
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if(stopping)
+            throw std::runtime_error("The sensor coalescer is stopping");
+        pending.push_back(std::move(new_request));
+    }
+    changed.notify_all();
+    return future;
+}
+
+coalescer_stats MSR_SensorCoalescer::get_stats()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return stats;
+}
+
+void MSR_SensorCoalescer::work()
+{
+    MSR_PriorityScope scope(command_priority::live);
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true)
+    {
+        changed.wait(lock, [this] () { return stopping || pending.size(); });
+        if(pending.empty()) return; //stopping
+        //give other callers the window to join the batch
+        changed.wait_for(lock, window, [this] () { return stopping; });
+        std::vector<request> batch;
+        batch.swap(pending);
+        lock.unlock();
+        read_batch(batch);
+        lock.lock();
+    }
+}
+
+void MSR_SensorCoalescer::read_batch(std::vector<request> &batch)
+{
+    std::vector<sampletype> types;
+    uint64_t channels_requested = 0;
+    for(auto &cur_request : batch)
+    {
+        channels_requested += cur_request.types.size();
+        for(auto type : cur_request.types)
+            if(std::find(types.begin(), types.end(), type) == types.end())
+                types.push_back(type);
+    }
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stats.requests += batch.size();
+        stats.batches++;
+        stats.channels_requested += channels_requested;
+        stats.channels_read += types.size();
+        stats.frames += (types.size() + 2) / 3;
+    }
+    try
+    {
+        std::vector<int16_t> values(types.size());
+        device.get_sensor_data(types.data(), types.size(), values.data());
+        for(auto &cur_request : batch)
+        {
+            std::vector<int16_t> result;
+            for(auto type : cur_request.types)
+                result.push_back(values[std::find(types.begin(), types.end(), type) - types.begin()]);
+            cur_request.promise.set_value(result);
+        }
+    }
+    catch(...)
+    {
+        for(auto &cur_request : batch)
+            cur_request.promise.set_exception(std::current_exception());
+    }
+}
@@ -0,0 +1,115 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "libmsr145.hpp"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+std::vector<std::string> MSR_Discovery::get_default_patterns()
+{
+    return {"/dev/ttyUSB*", "/dev/ttyACM*"};
+}
+
+bool MSR_Discovery::probe_port(const std::string &port, discovered_device &device)
+{
+    try
+    {
+        MSRDevice msr(port);
+        msr.set_retry_budget(1);
+        msr.set_initial_timeout(probe_timeout);
+        device.port = port;
+        auto &metrics = msr.get_metrics();
+        for(int attempt = 0; attempt < 3; attempt++)
+        {   //with only one retry, the answers may still be busy ones without data. Read again if so.
+            uint64_t busy = metrics.busy;
+            msr.get_firmware_version(&device.firmware_major, &device.firmware_minor);
+            device.serial = msr.get_serial();
+            if(metrics.busy == busy) break;
+        }
+        //something else answering on the port is not likely to get the checksums right
+        return metrics.crc_failures == 0;
+    }
+    catch(std::exception &)
+    {   //no device, or the port could not be opened
+        return false;
+    }
+}
+
+std::vector<discovered_device> MSR_Discovery::discover(const std::vector<std::string> &ports)
+{
+    std::vector<discovered_device> found(ports.size());
+    std::vector<char> ok(ports.size(), false);
+    std::atomic<size_t> next_port(0);
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < std::min(max_threads, ports.size()); i++)
+        threads.emplace_back([&] ()
+        {
+            for(size_t j = next_port++; j < ports.size(); j = next_port++)
+                ok[j] = probe_port(ports[j], found[j]);
+        });
+    for(auto &thread : threads)
+        thread.join();
+
+    std::vector<discovered_device> devices;
+    for(size_t i = 0; i < ports.size(); i++)
+        if(ok[i]) devices.push_back(found[i]);
+
+    if(cache_file.size())
+    {   //forget the devices which were on the probed ports before, and add the ones found now
+        auto port_map = load_cache();
+        for(auto it = port_map.begin(); it != port_map.end(); )
+        {
+            if(std::find(ports.begin(), ports.end(), it->second) != ports.end())
+                it = port_map.erase(it);
+            else
+                it++;
+        }
+        for(auto &device : devices)
+            port_map[device.serial] = device.port;
+        save_cache(port_map);
+    }
+    return devices;
+}
+
+std::map<std::string, std::string> MSR_Discovery::load_cache()
+{
+    std::map<std::string, std::string> port_map;
+    std::ifstream cache(cache_file);
+    std::string serial, port;
+    while(cache >> serial >> port)
+        port_map[serial] = port;
+    return port_map;
+}
+
+void MSR_Discovery::save_cache(const std::map<std::string, std::string> &port_map)
+{
+    std::ofstream cache(cache_file);
+    for(auto &entry : port_map)
+        cache << entry.first << " " << entry.second << "\n";
+}
+
+std::string MSR_Discovery::resolve(const std::string &serial)
+{
+    if(cache_file.size())
+    {
+        auto port_map = load_cache();
+        auto cached = port_map.find(serial);
+        discovered_device device;
+        if(cached != port_map.end() && probe_port(cached->second, device) && device.serial == serial)
+            return device.port;
+    }
+    for(auto &device : discover(expand_port_patterns(get_default_patterns())))
+        if(device.serial == serial)
+            return device.port;
+    throw std::runtime_error("Could not find a device with serial " + serial);
+}
@@ -0,0 +1,94 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "libmsr145.hpp"
+#include <stdexcept>
+
+LiveStream::LiveStream(MSR_Reader &_device, const std::vector<sampletype> &_types, std::chrono::microseconds _interval,
+    size_t capacity) : device(_device), interval(_interval), ring(capacity),
+    readings(0), overruns(0), missed_deadlines(0), errors(0)
+{
+    if(_types.size() > MSR_LIVE_MAX_CHANNELS)
+        throw std::invalid_argument("LiveStream can read at most " + std::to_string(MSR_LIVE_MAX_CHANNELS) + " sensors");
+    type_count = _types.size();
+    std::copy(_types.begin(), _types.end(), types);
+}
+
+LiveStream::~LiveStream()
+{
+    stop();
+}
+
+void LiveStream::start()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    if(running) return;
+    running = true;
+    thread = std::thread(&LiveStream::poll, this);
+}
+
+void LiveStream::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if(!running) return;
+        running = false;
+    }
+    stop_requested.notify_all();
+    thread.join();
+}
+
+void LiveStream::poll()
+{
+    MSR_PriorityScope scope(command_priority::live);
+    auto next = std::chrono::steady_clock::now();
+    while(true)
+    {
+        live_reading reading;
+        try
+        {
+            device.get_sensor_data(types, type_count, reading.values);
+            reading.time = std::chrono::steady_clock::now();
+            reading.count = type_count;
+            readings++;
+            if(!ring.push(reading)) overruns++;
+        }
+        catch(std::exception &)
+        {   //msr_error, or e.g. a system_error from an unplugged port. The device may come back,
+            //so keep trying at the same rate
+            errors++;
+        }
+        next += interval;
+        auto now = std::chrono::steady_clock::now();
+        if(now > next)
+        {   //skip the readings we are too late for, instead of catching up
+            auto missed = (now - next) / interval + 1;
+            missed_deadlines += missed;
+            next += interval * missed;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        if(stop_requested.wait_until(lock, next, [this] () { return !running; }))
+            return;
+    }
+}
+
+size_t LiveStream::drain(live_reading *out, size_t max_count)
+{
+    return ring.pop(out, max_count);
+}
+
+size_t LiveStream::drain(const std::function<void(const live_reading &reading)> &callback)
+{
+    live_reading batch[64];
+    size_t total = 0;
+    for(size_t count; (count = ring.pop(batch, 64)) > 0; total += count)
+        for(size_t i = 0; i < count; i++)
+            callback(batch[i]);
+    return total;
+}
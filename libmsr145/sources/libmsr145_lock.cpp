@@ -0,0 +1,82 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "libmsr145_lock.hpp"
+
+void MSR_PriorityLock::lock(int priority)
+{
+    std::unique_lock<std::mutex> guard(mutex);
+    if(depth && owner == std::this_thread::get_id())
+    {
+        depth++;
+        return;
+    }
+    if(depth == 0 && waiting.empty())
+    {   //nobody to give way for
+        owner = std::this_thread::get_id();
+        depth = 1;
+        return;
+    }
+    auto ticket = std::make_pair(-priority, next_ticket++);
+    waiting.insert(ticket);
+    released.wait(guard, [this, &ticket] () { return depth == 0 && *waiting.begin() == ticket; });
+    waiting.erase(ticket);
+    owner = std::this_thread::get_id();
+    depth = 1;
+}
+
+void MSR_PriorityLock::unlock()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if(--depth) return;
+        owner = std::thread::id();
+    }
+    released.notify_all();
+}
+
+bool MSR_PriorityLock::try_lock(int priority, uint64_t &ticket)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    if(depth && owner == std::this_thread::get_id())
+    {
+        depth++;
+        return true;
+    }
+    if(ticket == MSR_NO_TICKET)
+    {
+        if(depth == 0 && waiting.empty())
+        {
+            owner = std::this_thread::get_id();
+            depth = 1;
+            return true;
+        }
+        ticket = next_ticket++;
+        waiting.insert(std::make_pair(-priority, ticket));
+        return false;
+    }
+    if(depth || *waiting.begin() != std::make_pair(-priority, ticket))
+        return false;
+    waiting.erase(waiting.begin());
+    ticket = MSR_NO_TICKET;
+    owner = std::this_thread::get_id();
+    depth = 1;
+    return true;
+}
+
+void MSR_PriorityLock::cancel(int priority, uint64_t &ticket)
+{
+    if(ticket == MSR_NO_TICKET) return;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        waiting.erase(std::make_pair(-priority, ticket));
+        ticket = MSR_NO_TICKET;
+    }
+    released.notify_all(); //the one behind us may be next now
+}
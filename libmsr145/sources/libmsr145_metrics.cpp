@@ -0,0 +1,153 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "libmsr145_metrics.hpp"
+#include <sstream>
+#include <iomanip>
+
+void MSR_Metrics::reset()
+{
+    for(auto &op : opcodes)
+    {
+        op.commands = 0;
+        op.latency_sum = 0;
+        for(auto &bucket : op.latency) bucket = 0;
+    }
+    bytes_out = 0;
+    bytes_in = 0;
+    retries = 0;
+    timeouts = 0;
+    busy = 0;
+    crc_failures = 0;
+    baud_changes = 0;
+    live_page_retries = 0;
+    wire_time = 0;
+    pacing_time = 0;
+    decode_time = 0;
+}
+
+void MSR_Metrics::add_round_trip(uint8_t opcode, uint64_t latency)
+{
+    size_t bucket = 0;
+    while(bucket < MSR_LATENCY_BUCKETS - 1 && latency >= (1ull << bucket)) bucket++;
+    opcodes[opcode].commands.fetch_add(1, std::memory_order_relaxed);
+    opcodes[opcode].latency_sum.fetch_add(latency, std::memory_order_relaxed);
+    opcodes[opcode].latency[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t MSR_Metrics::get_latency_percentile(uint8_t opcode, double percentile)
+{
+    uint64_t total = 0;
+    for(auto &bucket : opcodes[opcode].latency) total += bucket.load(std::memory_order_relaxed);
+    if(total == 0) return 0;
+    uint64_t count = 0;
+    for(size_t i = 0; i < MSR_LATENCY_BUCKETS; i++)
+    {
+        count += opcodes[opcode].latency[i].load(std::memory_order_relaxed);
+        if(count >= total * percentile) return 1ull << i;
+    }
+    return 1ull << (MSR_LATENCY_BUCKETS - 1);
+}
+
+uint64_t MSR_Metrics::get_total_commands()
+{
+    uint64_t total = 0;
+    for(auto &op : opcodes) total += op.commands.load(std::memory_order_relaxed);
+    return total;
+}
+
+std::string MSR_Metrics::report()
+{
+    std::stringstream ret_str;
+    ret_str << "Communication statistics:" << std::endl;
+    ret_str << "\tBytes out:\t\t" << bytes_out << std::endl;
+    ret_str << "\tBytes in:\t\t" << bytes_in << std::endl;
+    ret_str << "\tRetries:\t\t" << retries << std::endl;
+    ret_str << "\tTimeouts:\t\t" << timeouts << std::endl;
+    ret_str << "\tBusy answers:\t\t" << busy << std::endl;
+    ret_str << "\tCRC failures:\t\t" << crc_failures << std::endl;
+    ret_str << "\tBaudrate changes:\t" << baud_changes << std::endl;
+    ret_str << "\tLive page retries:\t" << live_page_retries << std::endl;
+    ret_str << std::fixed << std::setprecision(3);
+    ret_str << "\tWire time (s):\t\t" << wire_time / 1e6 << std::endl;
+    ret_str << "\tPacing time (s):\t" << pacing_time / 1e6 << std::endl;
+    ret_str << "\tDecode time (s):\t" << decode_time / 1e6 << std::endl;
+    ret_str << std::endl;
+    ret_str << "\tOpcode\tCommands\tMean (ms)\tp50 (ms)\tp99 (ms)" << std::endl;
+    for(int i = 0; i < 256; i++)
+    {
+        uint64_t commands = opcodes[i].commands;
+        if(commands == 0) continue;
+        ret_str << "\t0x" << std::hex << std::uppercase << i << std::dec << "\t" << commands << "\t\t"
+            << opcodes[i].latency_sum / 1e3 / commands << "\t\t"
+            << get_latency_percentile(i, 0.5) / 1e3 << "\t\t"
+            << get_latency_percentile(i, 0.99) / 1e3 << std::endl;
+    }
+    return ret_str.str();
+}
+
+std::string MSR_Metrics::prometheus(const std::vector<std::pair<std::string, MSR_Metrics *> > &devices)
+{
+    std::stringstream ret_str;
+    ret_str << std::setprecision(10);
+    struct counter
+    {
+        const char *name;
+        const char *help;
+        std::atomic<uint64_t> MSR_Metrics::*member;
+        double scale;
+    };
+    const counter counters[] =
+    {
+        {"msr145_bytes_out_total", "Bytes send to the device", &MSR_Metrics::bytes_out, 1},
+        {"msr145_bytes_in_total", "Bytes received from the device", &MSR_Metrics::bytes_in, 1},
+        {"msr145_retries_total", "Commands send again after a timeout or busy answer", &MSR_Metrics::retries, 1},
+        {"msr145_timeouts_total", "Attempts the device didn't answer in time, including those which were retried", &MSR_Metrics::timeouts, 1},
+        {"msr145_busy_total", "Busy answers from the device", &MSR_Metrics::busy, 1},
+        {"msr145_crc_failures_total", "Answers with a wrong CRC", &MSR_Metrics::crc_failures, 1},
+        {"msr145_baud_changes_total", "Baudrate changes", &MSR_Metrics::baud_changes, 1},
+        {"msr145_live_page_retries_total", "Live page reads thrown away as the page changed", &MSR_Metrics::live_page_retries, 1},
+        {"msr145_wire_seconds_total", "Time spend waiting for the device", &MSR_Metrics::wire_time, 1e-6},
+        {"msr145_pacing_seconds_total", "Time spend waiting between commands", &MSR_Metrics::pacing_time, 1e-6},
+        {"msr145_decode_seconds_total", "Time spend decoding and formatting samples", &MSR_Metrics::decode_time, 1e-6},
+    };
+    for(auto &c : counters)
+    {
+        ret_str << "# HELP " << c.name << " " << c.help << "\n# TYPE " << c.name << " counter\n";
+        for(auto &device : devices)
+            ret_str << c.name << "{" << device.first << "} " << ((*device.second).*c.member).load(std::memory_order_relaxed) * c.scale << "\n";
+    }
+    ret_str << "# HELP msr145_command_latency_seconds Round trip time of the commands, by opcode\n"
+        "# TYPE msr145_command_latency_seconds histogram\n";
+    for(auto &device : devices)
+    {
+        std::string labels = device.first + (device.first.size() ? "," : "");
+        for(int i = 0; i < 256; i++)
+        {
+            opcode_metrics &op = device.second->opcodes[i];
+            uint64_t commands = op.commands.load(std::memory_order_relaxed);
+            if(commands == 0) continue;
+            std::stringstream opcode;
+            opcode << "opcode=\"0x" << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << i << "\"";
+            uint64_t count = 0;
+            for(size_t bucket = 0; bucket < MSR_LATENCY_BUCKETS - 1; bucket++)
+            {   //bucket i counts round trips shorter than 2^i us. They are whole us, so at most 2^i - 1 us
+                count += op.latency[bucket].load(std::memory_order_relaxed);
+                ret_str << "msr145_command_latency_seconds_bucket{" << labels << opcode.str() << ",le=\""
+                    << ((1ull << bucket) - 1) * 1e-6 << "\"} " << count << "\n";
+            }
+            count += op.latency[MSR_LATENCY_BUCKETS - 1].load(std::memory_order_relaxed);
+            ret_str << "msr145_command_latency_seconds_bucket{" << labels << opcode.str() << ",le=\"+Inf\"} " << count << "\n";
+            ret_str << "msr145_command_latency_seconds_sum{" << labels << opcode.str() << "} "
+                << op.latency_sum.load(std::memory_order_relaxed) * 1e-6 << "\n";
+            ret_str << "msr145_command_latency_seconds_count{" << labels << opcode.str() << "} " << count << "\n";
+        }
+    }
+    return ret_str.str();
+}
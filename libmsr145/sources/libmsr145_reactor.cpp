@@ -0,0 +1,336 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "libmsr145.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define MSR_REACTOR_STOP_EVENT UINT64_MAX //epoll data of the stop eventfd, the devices have their id
+
+DeviceReactor::DeviceReactor(int _priority) : stopping(false), priority(_priority)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd < 0)
+        throw std::runtime_error(std::string("Could not create the epoll of the reactor: ") + strerror(errno));
+    stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(stop_fd < 0)
+    {
+        close(epoll_fd);
+        throw std::runtime_error(std::string("Could not create the eventfd of the reactor: ") + strerror(errno));
+    }
+    //edge triggered, so it doesn't have to be read
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.u64 = MSR_REACTOR_STOP_EVENT;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event);
+}
+
+DeviceReactor::~DeviceReactor()
+{   //run only returns when no device is waited for, so there are no sessions to give back
+    close(stop_fd);
+    close(epoll_fd);
+}
+
+size_t DeviceReactor::add_device(MSR_Base &device, std::vector<sampletype> types,
+    std::chrono::microseconds sensor_interval, std::chrono::microseconds status_interval)
+{
+    int fd = device.get_fd();
+    if(fd < 0)
+        throw std::invalid_argument("The transport of the device can't be waited on");
+    size_t id = devices.size();
+    //Edge triggered, as receive reads everything which has arrived. A port which fails or hangs up
+    //then wakes us once, and not on every wait until the command times out.
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.u64 = id;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        throw std::runtime_error(std::string("Could not wait on the device: ") + strerror(errno));
+    devices.emplace_back(new device_state(device));
+    device_state &state = *devices.back();
+    state.types = types;
+    state.sensor_interval = sensor_interval;
+    state.status_interval = status_interval;
+    //the first polls are done right away
+    auto now = clock::now();
+    if(sensor_interval.count() > 0 && types.size())
+        state.next_sensor = now;
+    if(status_interval.count() > 0)
+        state.next_status = now;
+    return id;
+}
+
+static void next_poll(std::chrono::steady_clock::time_point &next, std::chrono::microseconds interval,
+    std::chrono::steady_clock::time_point now, uint64_t &skipped)
+{   //keep the polls on a fixed schedule, but don't try to catch up if we have fallen behind
+    next += interval;
+    if(next > now) return;
+    auto missed = (now - next) / interval + 1;
+    skipped += missed;
+    next += interval * missed;
+}
+
+void DeviceReactor::schedule(device_state &device, clock::time_point now)
+{   //Queues the polls which are due
+    if(now >= device.next_sensor)
+    {
+        if(device.sensor_pending)
+            device.stats.skipped++;
+        else
+        {
+            device.sensor_pending = true;
+            device.stats.polls++;
+        }
+        next_poll(device.next_sensor, device.sensor_interval, now, device.stats.skipped);
+    }
+    if(now >= device.next_status)
+    {
+        if(device.status_pending)
+            device.stats.skipped++;
+        else
+        {
+            device.status_pending = true;
+            device.stats.polls++;
+        }
+        next_poll(device.next_status, device.status_interval, now, device.stats.skipped);
+    }
+}
+
+bool DeviceReactor::start_job(device_state &device)
+{   //Picks the next poll to do, returns false if there is none
+    if(device.status_pending)
+    {
+        device.job = status_job;
+        uint8_t command[] = {0x82, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00};
+        memcpy(device.command, command, sizeof(command));
+    }
+    else if(device.sensor_pending)
+    {
+        device.job = sensor_job;
+        device.chunk = 0;
+        device.values.clear();
+    }
+    else
+        return false;
+    prepare_command(device);
+    return true;
+}
+
+void DeviceReactor::prepare_command(device_state &device)
+{
+    if(device.job == sensor_job)
+    {   //The sensors are read three at a time, as in MSR_Reader::get_sensor_data
+        uint8_t command[] = {0x82, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
+        for(size_t j = 0; j < 3 && device.chunk + j < device.types.size(); j++)
+            command[2 + j] = device.types[device.chunk + j];
+        memcpy(device.command, command, sizeof(command));
+    }
+    device.state = command_state();
+    device.state.command = device.command;
+    device.state.command_length = sizeof(device.command);
+    device.state.out = device.answer;
+    device.state.out_length = sizeof(device.answer);
+    device.step = wait_lock;
+}
+
+void DeviceReactor::advance(size_t id)
+{   //Takes the device as far as it gets without waiting. Returns with wake set, unless the device is idle.
+    device_state &device = *devices[id];
+    MSR_Base &msr = device.device;
+    while(true)
+    {
+        auto now = clock::now();
+        try
+        {
+            switch(device.step)
+            {
+                case idle:
+                    if(finishing || !start_job(device)) return;
+                    break;
+                case wait_lock:
+                    if(finishing)
+                    {   //the poll is dropped
+                        msr.cancel_lock_session(priority, device.ticket);
+                        finish_job(device);
+                        return;
+                    }
+                    if(!msr.try_lock_session(priority, device.ticket))
+                    {   //another thread is sending, or is before us in line
+                        device.wake = now + MSR_REACTOR_LOCK_POLL;
+                        return;
+                    }
+                    device.step = wait_send;
+                    break;
+                case wait_send:
+                    if(now < msr.get_send_time())
+                    {
+                        device.wake = msr.get_send_time();
+                        return;
+                    }
+                    msr.begin_attempt(device.state);
+                    device.step = wait_answer;
+                    break;
+                case wait_answer:
+                {
+                    if(!msr.receive(device.state) && now < device.state.deadline)
+                    {
+                        device.wake = device.state.deadline;
+                        return;
+                    }
+                    auto result = msr.end_attempt(device.state);
+                    if(result == command_result::done)
+                    {
+                        msr.unlock_session();
+                        device.step = idle;
+                        finish_command(id);
+                    }
+                    else if(result == command_result::retry)
+                    {
+                        device.state.attempt++;
+                        device.step = wait_send;
+                    }
+                    else
+                    {
+                        device.wake = now + msr.get_recovery_delay(device.state.attempt);
+                        device.step = backoff;
+                        return;
+                    }
+                    break;
+                }
+                case backoff:
+                    if(now < device.wake) return;
+                    msr.reset_link(device.state.attempt);
+                    device.state.attempt++;
+                    device.step = wait_send;
+                    break;
+            }
+        }
+        catch(std::exception &e)
+        {   //the poll is dropped, the next one will try again
+            if(device.step != idle && device.step != wait_lock)
+                msr.unlock_session();
+            if(dynamic_cast<msr_timeout_error *>(&e))
+                device.stats.timeouts++;
+            else
+                device.stats.errors++;
+            finish_job(device);
+            report_error(id, e.what());
+            return;
+        }
+    }
+}
+
+void DeviceReactor::finish_command(size_t id)
+{   //The session has been given back
+    device_state &device = *devices[id];
+    if(device.answer[0] & 0x20)
+    {
+        device.stats.errors++;
+        finish_job(device);
+        report_error(id, "The device is busy");
+        return;
+    }
+    device.stats.answers++;
+    if(device.job == status_job)
+    {
+        reactor_status status;
+        status.recording = device.answer[1] & 0x03;
+        status.end_address = (device.answer[4] << 8) + device.answer[3];
+        finish_job(device);
+        if(status_callback) status_callback(id, status);
+        return;
+    }
+    for(size_t j = 0; j < 3 && device.values.size() < device.types.size(); j++)
+        device.values.push_back(device.answer[j * 2 + 1] + (device.answer[j * 2 + 2] << 8));
+    device.chunk += 3;
+    if(device.chunk < device.types.size())
+    {
+        prepare_command(device);
+        return;
+    }
+    finish_job(device);
+    if(sensor_callback) sensor_callback(id, device.values);
+}
+
+void DeviceReactor::finish_job(device_state &device)
+{
+    if(device.job == status_job)
+        device.status_pending = false;
+    else if(device.job == sensor_job)
+        device.sensor_pending = false;
+    device.job = no_job;
+    device.step = idle;
+}
+
+void DeviceReactor::report_error(size_t id, const std::string &error)
+{
+    if(error_callback) error_callback(id, error);
+}
+
+void DeviceReactor::run_until(clock::time_point end)
+{
+    epoll_event events[MSR_REACTOR_MAX_EVENTS];
+    while(true)
+    {
+        //The devices are few enough (hundreds) to look at all of them after each wait
+        auto now = clock::now();
+        finishing = stopping || now >= end;
+        auto wake = finishing ? clock::time_point::max() : end;
+        bool busy = false;
+        for(size_t id = 0; id < devices.size(); id++)
+        {
+            device_state &device = *devices[id];
+            if(!finishing) schedule(device, now);
+            if(device.step == idle || device.wake <= now)
+                advance(id);
+            if(device.step != idle)
+            {
+                busy = true;
+                wake = std::min(wake, device.wake);
+            }
+            if(!finishing) wake = std::min({wake, device.next_sensor, device.next_status});
+        }
+        if(finishing && !busy) return;
+        int wait_ms = -1;
+        if(wake != clock::time_point::max())
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(wake - clock::now()).count();
+            wait_ms = std::max<int64_t>((remaining + 999) / 1000, 0);
+        }
+        int count = epoll_wait(epoll_fd, events, MSR_REACTOR_MAX_EVENTS, wait_ms);
+        if(count < 0 && errno != EINTR)
+            throw std::runtime_error(std::string("Waiting for the devices failed: ") + strerror(errno));
+        for(int i = 0; i < count; i++)
+        {
+            if(events[i].data.u64 == MSR_REACTOR_STOP_EVENT) continue; //stopping is looked at in the next round
+            if(devices[events[i].data.u64]->step == wait_answer)
+                advance(events[i].data.u64);
+        }
+    }
+}
+
+void DeviceReactor::run()
+{
+    run_until(clock::time_point::max());
+}
+
+void DeviceReactor::run_for(std::chrono::microseconds duration)
+{
+    run_until(clock::now() + duration);
+}
+
+void DeviceReactor::stop()
+{
+    stopping = true;
+    eventfd_write(stop_fd, 1);
+}
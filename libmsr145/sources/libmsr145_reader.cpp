@@ -10,6 +10,7 @@
 #include "libmsr145.hpp"
 #include <string>
 #include <iostream>
+#include <memory>
 #include <thread> //sleep_for
 
 void printbytes(uint8_t *bytes, size_t len)
@@ -42,6 +43,49 @@ void MSR_Reader::update_sensors()
     std::this_thread::sleep_for(std::chrono::milliseconds(1000));
 }
 
+fresh_sensor_data MSR_Reader::get_fresh_sensor_data(std::vector<sampletype> &types, std::chrono::milliseconds max_wait)
+{
+    fresh_sensor_data data;
+    data.values = get_sensor_data(types);
+    data.latency.assign(types.size(), -1);
+    std::vector<std::chrono::steady_clock::time_point> deadlines;
+
+    uint8_t command1[] = {0x86, 0x03, 0x00, 0xFF, 0x00, 0x00, 0x00};
+    this->send_command(command1, sizeof(command1), nullptr, 8);
+    auto trigger_time = std::chrono::steady_clock::now();
+    for(auto type : types)
+    {
+        auto wait = std::chrono::microseconds(max_wait);
+        int64_t latency = conversion_latency[type & 0x0F].load(std::memory_order_relaxed);
+        if(latency)
+            wait = std::min(wait, std::chrono::microseconds(latency * 2));
+        deadlines.push_back(trigger_time + wait);
+    }
+    std::vector<int16_t> values(types.size());
+    for(size_t waiting = types.size(); waiting > 0; )
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        get_sensor_data(types.data(), types.size(), values.data());
+        auto now = std::chrono::steady_clock::now();
+        waiting = 0;
+        for(size_t i = 0; i < types.size(); i++)
+        {
+            if(data.latency[i] >= 0) continue;
+            if(values[i] != data.values[i])
+            {
+                data.latency[i] = std::chrono::duration_cast<std::chrono::microseconds>(now - trigger_time).count();
+                std::atomic<int64_t> &longest = conversion_latency[types[i] & 0x0F];
+                int64_t seen = longest.load(std::memory_order_relaxed);
+                while(seen < data.latency[i] && !longest.compare_exchange_weak(seen, data.latency[i], std::memory_order_relaxed));
+            }
+            else if(now < deadlines[i])
+                waiting++;
+            data.values[i] = values[i];
+        }
+    }
+    return data;
+}
+
 void MSR_Reader::convert_to_tm(uint8_t *response_ptr, struct tm *time_s)
 {
     time_s->tm_year = response_ptr[6] + 100; //response[6] contains years since 2000
@@ -182,6 +226,7 @@ std::vector<rec_entry> MSR_Reader::get_rec_list(size_t max_num)
                     start_address = cur_address;
                 }
                 //don't break here.
+                // fall through
             case 0x21:  //this means that what we requested was the first page of the entry
                 //save the entry
                 new_entry = create_rec_entry(response, start_address, end_address, false);
@@ -217,31 +262,28 @@ std::vector<rec_entry> MSR_Reader::get_rec_list(size_t max_num)
 }
 
 
-void MSR_Reader::add_raw_samples(std::vector<std::pair<std::vector<uint8_t>, uint64_t> > &sample_pages,
-    bool &end, uint8_t *response, size_t response_size, uint16_t start_pos, bool live, uint16_t page_num, uint16_t cur_addr)
+void MSR_Reader::add_raw_samples(std::vector<raw_page> &sample_pages,
+    bool &end, uint8_t *response, size_t response_size, uint16_t start_pos, uint16_t address)
 {
     //load the data into the vector. ignore first 9 bytes(for now), they are timestamp, etc
-    std::vector<uint8_t> samples;
-
-    for(uint16_t j = start_pos; j < response_size - 1; j += 4)
+    //The page starts at response[1], so the words are counted from there.
+    raw_page sample_page;
+    sample_page.address = address;
+    sample_page.first_word = (start_pos - 1) / 4;
+    sample_page.timestamp = get_page_timestamp(response);
+    auto &samples = sample_page.data;
+
+    for(size_t j = start_pos; j + 4 <= response_size - 1; j += 4)
     {
         if(response[j] == 0xFF && response[j + 1] == 0xFF && response[j + 2] == 0xFF && response[j + 3] == 0xFF)
         {
             end = true;
-            if(live && j == start_pos)  //this means that we are trying to access the current page.
-            {
-                get_live_data(sample_pages, cur_addr, page_num == 0);  //Fetch the data by other means.
-                //printf("%d\n\n\n", j);
-            }
             break;
         }
         for(uint8_t k = 0; k < 4; k++)
             samples.push_back(response[j + k]);
     }
-    std::pair<std::vector<uint8_t>, uint64_t> sample_page;
-    sample_page.first = samples;
-    sample_page.second = get_page_timestamp(response);
-    sample_pages.push_back(sample_page);
+    sample_pages.push_back(std::move(sample_page));
 }
 
 uint64_t MSR_Reader::get_page_timestamp(__attribute__((unused))uint8_t *response)
@@ -258,26 +300,36 @@ uint64_t MSR_Reader::get_page_timestamp(__attribute__((unused))uint8_t *response
     return entry_time_seconds;
 }
 
-std::vector<std::pair<std::vector<uint8_t>, uint64_t> > MSR_Reader::get_raw_recording(rec_entry record)
+std::vector<raw_page> MSR_Reader::get_raw_recording(rec_entry record)
 { //recordings are read from the smallest memory location to the largest
-    if(!is_recording()) record.isRecording = false; //if we are not recording, this field is forced to be false.
-    std::vector<std::pair<std::vector<uint8_t>, uint64_t> > sample_pages;
+    MSR_SessionGuard session(*this);
+    live_page live;
+    if(record.isRecording)
+    {   //take the live page first. The pages before it are completed, so they can't change while we read them.
+        live = get_live_page();
+        record.isRecording = live.recording; //if we are not recording, this field is forced to be false.
+    }
+    std::vector<raw_page> sample_pages;
     size_t response_size = 0x0422;
-    uint8_t *response = new uint8_t[response_size];
+    std::vector<uint8_t> response(response_size);
 
     //the fetch command. Format is:
     //0x8B 0x00 0x00 <address lsb> <address msb> <length lsb> <length msb>
     uint8_t fetch_command[] = {0x8B, 0x00, 0x00, 0x00, 0x00, 0x20, 0x04};
     //std::vector<uint8_t> page_recordData;
     bool end = false;
-    this->set_baud(230400);
-    for(uint16_t i = 0; (i < record.length || record.isRecording) && !end; i++)
+    uint16_t i = 0;
+    MSR_BaudScope fast(*this, 230400);
+    //while recording, the pages before the live page are all part of the recording
+    for(; i < 0x2000 && (!end || record.isRecording); i++)
     {
-        //send the fetch command
         uint16_t cur_addr = (record.address + i) % 0x2000;
+        if(record.isRecording ? cur_addr == live.address : i >= record.length) break;
+        if(i) session.yield(); //live reads of other threads go in between the pages
+        //send the fetch command
         fetch_command[3] = cur_addr & 0xFF;
         fetch_command[4] = cur_addr >> 8;
-        this->send_command(fetch_command, sizeof(fetch_command), response, response_size);
+        this->send_command(fetch_command, sizeof(fetch_command), response.data(), response_size);
         uint16_t start_pos;
         if(i == 0)
         { //in the first chunk, the first 6 * 15 bytes are some kind of preample, which counts from 0 to 0xF
@@ -290,80 +342,181 @@ std::vector<std::pair<std::vector<uint8_t>, uint64_t> > MSR_Reader::get_raw_reco
         }
         //for(int k = 8; k < 16; k++) printf("%02X", response[k]);
         //printf("\n");
-        add_raw_samples(sample_pages, end, response, response_size, start_pos, record.isRecording, i, cur_addr);
+        add_raw_samples(sample_pages, end, response.data(), response_size, start_pos, cur_addr);
+    }
+    if(record.isRecording && live.data.size())
+    {
+        uint16_t start_pos = i == 0 ? 0 +9 + 2 + 6 * 0xF : 9 + 2 + 6;
+        add_raw_samples(sample_pages, end, live.data.data(), live.length + 2, start_pos, live.address);
     }
-    this->set_baud(9600);
-    delete[] response;
     return sample_pages;
 }
 
-void MSR_Reader::get_live_data(std::vector<std::pair<std::vector<uint8_t>, uint64_t> > &sample_pages,
-    uint16_t cur_addr, bool isFirstPage)
-{   //Beware, this may contain bugs! Hard to debug, as the timing may be different each time.
-
-    //first, fetch the data from the "live" page, using the special command.
-    uint8_t start_pos = 17;
-    if(isFirstPage) start_pos = 0 +9 + 6 * 0xF + 2;
-    size_t response_size = 0x0422;
-    uint8_t *live_data = new uint8_t[response_size];
-    uint8_t *page_data = new uint8_t[response_size];
-    //std::vector<uint8_t> data;
-    uint8_t get_live_length[] = {0x82, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00};
-    this->send_command(get_live_length, sizeof(get_live_length), live_data, 8);
-    uint16_t length = ((live_data[6] << 8) + live_data[5]) * 2;
-
-    uint8_t get_live_page[] =   {0x8B, 0x00, 0x01, 0x00, 0x00, ((uint8_t)(length & 0xFF)), ((uint8_t)(length >> 8))};
-    this->send_command(get_live_page, sizeof(get_live_page), live_data, length + 2);
-    //check if the current address page is still unaccessable
-    uint8_t fetch_command[] = {0x8B, 0x00, 0x00, ((uint8_t)(cur_addr & 0xFF)), ((uint8_t)(cur_addr >> 8)), 0x20, 0x04};
-    this->send_command(fetch_command, sizeof(fetch_command), page_data, response_size);
-    if(!(page_data[start_pos + 0] == 0xFF && page_data[start_pos + 1] == 0xFF && page_data[start_pos + 2] == 0xFF && page_data[start_pos + 3] == 0xFF))
+live_page MSR_Reader::get_live_page(uint16_t known_address, uint16_t known_length, uint64_t known_time, unsigned max_retries)
+{
+    live_page live;
+    //the header timestamp the page at expected_address should have, 0 if unknown
+    uint16_t expected_address = known_address;
+    uint64_t expected_time = known_time;
+    uint8_t get_status[] = {0x82, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00};
+    uint8_t status[8];
+    this->send_command(get_status, sizeof(get_status), status, sizeof(status));
+    for(unsigned attempt = 0; ; attempt++)
     {
-        //the page have changed. first, fetch new live page
-        this->send_command(get_live_length, sizeof(get_live_length), live_data, 8);
-        length = ((live_data[6] << 8) + live_data[5]) * 2;
-        get_live_page[5] = length & 0xFF;
-        get_live_page[6] = length >> 8;
-        this->send_command(get_live_page, sizeof(get_live_page), live_data, length + 2);
-        //read page into vector
-        add_raw_samples(sample_pages, isFirstPage, page_data, response_size, start_pos, 0, 1, cur_addr);
-        //startpos will be 17 now
-        start_pos = 17;
+        live.recording = status[1] & 0x03;
+        //the page being written is the one after the last written page
+        live.address = ((status[4] << 8) + status[3] + 1) % 0x2000;
+        live.length = ((status[6] << 8) + status[5]) * 2;
+        live.retries = attempt;
+        if(!live.recording || live.length == 0 || (live.address == known_address && live.length <= known_length))
+        {
+            live.data.clear();
+            return live;
+        }
+        live.data.resize(live.length + 2);
+        uint8_t get_live_page[] = {0x8B, 0x00, 0x01, 0x00, 0x00, ((uint8_t)(live.length & 0xFF)), ((uint8_t)(live.length >> 8))};
+        this->send_command(get_live_page, sizeof(get_live_page), live.data.data(), live.data.size());
+        live.page_time = get_page_timestamp(live.data.data());
+        //The page only grows while it is recorded to. If it was completed, or the recording was restarted,
+        //the bytes we got may belong to either page.
+        this->send_command(get_status, sizeof(get_status), status, sizeof(status));
+        uint16_t after_address = ((status[4] << 8) + status[3] + 1) % 0x2000;
+        uint16_t after_length = ((status[6] << 8) + status[5]) * 2;
+        //a page rewritten at the same address (the recording restarted, or the ring buffer wrapped) can have the
+        //same or a longer length, only its header tells
+        bool same_page = !expected_time || live.address != expected_address || live.page_time == expected_time;
+        if(same_page && (status[1] & 0x03) && after_address == live.address && after_length >= live.length)
+            return live;
+        //the next read must agree with this one
+        expected_address = live.address;
+        expected_time = live.page_time;
+        if(attempt + 1 >= max_retries)
+            throw msr_error("The live page changed on every read", 0x8B);
+        metrics.live_page_retries++;
+        //the status just read is the starting point of the next attempt
     }
-    //read livedata into vector
-    add_raw_samples(sample_pages, isFirstPage, live_data, length, start_pos, 0, 1, cur_addr);
-    //for(size_t i = 0; i < data.size(); i+=4) printf("%02X %02X %02X %02X\n", data[i], data[i + 1], data[i +2], data[i + 3]);
-    delete[] live_data;
-    delete[] page_data;
 }
 
-
 std::vector<sample> MSR_Reader::get_samples(rec_entry record)
 {
     std::vector<sample> samples;
     auto pages = this->get_raw_recording(record);
+    MSR_ScopedTimer decode_timer(metrics.decode_time);
+    if(pages.empty()) return samples;
     uint64_t timestamp = 0; //time since start of record in 1/131072 seconds
+    //Samples are taken in the order of their position in the recording (page number in the recording, and word in
+    //the page). If a part of a page is read twice, e.g. from the flash and the live page, the words before the
+    //last position taken are skipped, so the samples are returned in order and without duplicates.
+    uint32_t next_position = 0;
     //run through the raw data and convert it to samples
-    uint64_t start_time = (pages[0].second >> 9) << 9;
+    uint64_t start_time = (pages[0].timestamp >> 9) << 9;
     for( auto &page : pages)
     {
-        auto &rawdata = page.first;
+        auto &rawdata = page.data;
+        uint32_t page_number = (page.address - record.address) & 0x1FFF;
         //printf("%f\n", timestamp / (512. * (1 << 8)));
-        timestamp = ((page.second) - start_time); // adjust timestamp to the one given at page start
+        timestamp = ((page.timestamp) - start_time); // adjust timestamp to the one given at page start
         //printf("%f\n\n", timestamp / (512. * (1 << 8)));
-        //printf("NEW page. timestamp: %lu, starttime: %lu, number: %d\n", page.second, start_time, pagenum++);
         for(size_t i = 0; i < rawdata.size(); i += 4)
         {
+            uint16_t word = page.first_word + i / 4;
+            uint32_t position = (page_number << 9) + word; //less than 512 words in a page
             auto cur_sample = convert_to_sample(rawdata.data() + i, &timestamp);
             //printf("0x%08x\n",cur_sample.rawsample);
             if(cur_sample.type == sampletype::end) break;
+            if(position < next_position) continue;
+            next_position = position + 1;
             if(cur_sample.type == sampletype::timestamp) continue;
+            cur_sample.address = page.address;
+            cur_sample.word = word;
             samples.push_back(cur_sample);
         }
     }
     return samples;
 }
 
+std::vector<sample> MSR_Reader::get_new_samples(const rec_entry &record, follow_cursor &cursor)
+{
+    std::vector<sample> samples;
+    if(cursor.finished) return samples;
+    MSR_SessionGuard session(*this);
+    if(!cursor.started)
+    {
+        cursor.address = record.address;
+        cursor.offset = 0 +9 + 2 + 6 * 0xF;
+        cursor.started = true;
+    }
+    //the live page is read first, so the pages before it are completed when we read them.
+    //The page is only fetched if it has grown past the cursor.
+    live_page live;
+    uint16_t end_address = (record.address + record.length) % 0x2000;
+    if(record.isRecording)
+    {
+        live = get_live_page(cursor.address, cursor.offset + 2, cursor.page_time);
+        end_address = live.address;
+        if(live.data.size() && live.address == cursor.address && cursor.page_time && live.page_time != cursor.page_time)
+        {   //the page the cursor is in has been rewritten, so its samples are new from the start of the page
+            cursor.offset = cursor.address == record.address ? 0 +9 + 2 + 6 * 0xF : 9 + 2 + 6;
+            cursor.page_time = 0;
+        }
+    }
+    bool recording = live.recording;
+
+    //first, the pages which are completed, but which we haven't read to the end
+    size_t response_size = 0x0422;
+    std::vector<uint8_t> response(response_size);
+    uint8_t fetch_command[] = {0x8B, 0x00, 0x00, 0x00, 0x00, 0x20, 0x04};
+    std::unique_ptr<MSR_BaudScope> fast; //only if there are pages to fetch
+    while(cursor.address != end_address)
+    {
+        if(!fast) fast.reset(new MSR_BaudScope(*this, 230400));
+        fetch_command[3] = cursor.address & 0xFF;
+        fetch_command[4] = cursor.address >> 8;
+        this->send_command(fetch_command, sizeof(fetch_command), response.data(), response_size);
+        if(add_new_samples(response.data(), response_size - 1, cursor, samples) && !recording)
+            break; //the end of a stopped recording
+        cursor.address = (cursor.address + 1) % 0x2000;
+        cursor.offset = 9 + 2 + 6;
+        cursor.page_time = 0;
+    }
+    fast.reset();
+    if(!recording)
+    {
+        cursor.finished = true;
+        return samples;
+    }
+
+    //then the new samples of the live page
+    if(live.data.size())
+        add_new_samples(live.data.data(), live.length + 1, cursor, samples);
+    return samples;
+}
+
+bool MSR_Reader::add_new_samples(uint8_t *response, size_t data_end, follow_cursor &cursor, std::vector<sample> &samples)
+{   //Decodes the samples in response from the cursor up to data_end. Returns true if the end marker was found.
+    MSR_ScopedTimer decode_timer(metrics.decode_time);
+    uint64_t page_time = get_page_timestamp(response);
+    if(cursor.start_time == 0)
+        cursor.start_time = (page_time >> 9) << 9;
+    if(cursor.page_time == 0)
+    {   //adjust timestamp to the one given at page start
+        cursor.page_time = page_time;
+        cursor.timestamp = page_time - cursor.start_time;
+    }
+    for(; cursor.offset + 4u <= data_end; cursor.offset += 4)
+    {
+        uint64_t timestamp = cursor.timestamp;
+        auto cur_sample = convert_to_sample(response + cursor.offset, &timestamp);
+        if(cur_sample.type == sampletype::end) return true;
+        cursor.timestamp = timestamp;
+        if(cur_sample.type == sampletype::timestamp) continue;
+        cur_sample.address = cursor.address;
+        cur_sample.word = (cursor.offset - 1) / 4;
+        samples.push_back(cur_sample);
+    }
+    return false;
+}
+
 sample MSR_Reader::convert_to_sample(uint8_t *sample_ptr, uint64_t *total_time)
 {   //convert the 4 bytes pointed to by sample_ptr into the sample struct
     sample this_sample;
@@ -429,23 +582,26 @@ sample MSR_Reader::convert_to_sample(uint8_t *sample_ptr, uint64_t *total_time)
 
 std::vector<int16_t> MSR_Reader::get_sensor_data(std::vector<sampletype> &types)
 {
-    std::vector<int16_t> return_vec;
-    size_t response_size = 8;
-    uint8_t *response = new uint8_t[response_size];
-    for(size_t i = 0; i < types.size(); i += 3)
+    std::vector<int16_t> return_vec(types.size());
+    get_sensor_data(types.data(), types.size(), return_vec.data());
+    return return_vec;
+}
+
+void MSR_Reader::get_sensor_data(const sampletype *types, size_t count, int16_t *values)
+{
+    uint8_t response[8];
+    for(size_t i = 0; i < count; i += 3)
     {
         uint8_t typebytes[3] = {0x00, 0x00, 0x00};
         for(uint8_t j = 0; j < 3; j++)
-            if(i + j < types.size() ) typebytes[j] = types[i + j];
+            if(i + j < count) typebytes[j] = types[i + j];
         uint8_t fetch_data[] = {0x82, 0x02, typebytes[0], typebytes[1], typebytes[2], 0x00, 0x00};
         //printbytes(fetch_data, 7);
-        this->send_command(fetch_data, sizeof(fetch_data), response, response_size);
+        this->send_command(fetch_data, sizeof(fetch_data), response, sizeof(response));
 
         for(uint8_t j = 0; j < 3; j++)
-            if(return_vec.size() < types.size()) return_vec.push_back(response[j * 2 + 1] + (response[j * 2 + 2] << 8));
+            if(i + j < count) values[i + j] = response[j * 2 + 1] + (response[j * 2 + 2] << 8);
     }
-    delete[] response;
-    return return_vec;
 }
 
 std::string MSR_Reader::get_name()
@@ -590,6 +746,7 @@ void MSR_Reader::get_sample_lim_setting(sampletype type, uint8_t *rec_settings,
     *limit2 = (response[6] << 8) + response[5];
     //std::cout << *limit1 << std::endl;
     //std::cout << *limit2 << std::endl;
+    delete[] response;
 }
 
 struct tm MSR_Reader::get_start_time()
@@ -628,3 +785,103 @@ void MSR_Reader::get_firmware_version(int *major, int *minor)
     *minor = response[5];
     delete[] response;
 }
+
+DeviceSnapshot MSR_Reader::get_snapshot(std::vector<sampletype> sensor_types)
+{   //Read every setting of the device in one session.
+    //The commands are send back to back at high baudrate, and every setting is only read once,
+    //so the result can be used for status output without further round trips.
+    //Other threads wait until it's done, and the baudrate is set back afterwards, also if a command fails.
+    DeviceSnapshot snapshot;
+    MSR_SessionGuard session(*this);
+    MSR_BaudScope fast(*this, 230400);
+    snapshot.serial = get_serial();
+    get_firmware_version(&snapshot.firmware_major, &snapshot.firmware_minor);
+    snapshot.name = get_name();
+    snapshot.device_time = get_device_time();
+    snapshot.recording = is_recording();
+    get_marker_setting(&snapshot.marker_on, &snapshot.alarm_confirm_on);
+    for(uint8_t i = 0; i < 8; i++)
+    {
+        snapshot.timers[i].interval = get_timer_interval(i);
+        get_active_measurements(i, &snapshot.timers[i].measurements, &snapshot.timers[i].blink);
+    }
+    get_start_setting(&snapshot.bufferon, &snapshot.start);
+    snapshot.start_time = get_start_time();
+    snapshot.end_time = get_end_time();
+    snapshot.active_limits = get_general_lim_settings();
+    for(uint8_t i = 0; i < 0xF; i++)
+    {
+        if(!(snapshot.active_limits & 1 << i)) continue;
+        limit_entry entry;
+        entry.type = (sampletype)i;
+        get_sample_lim_setting(entry.type, &entry.rec_settings, &entry.alarm_settings, &entry.limit1, &entry.limit2);
+        snapshot.limits.push_back(entry);
+    }
+    //the calibration name and date is read in the same two commands, so only do it once.
+    snapshot.calibration_name = get_calibration_name(&snapshot.calibration_year, &snapshot.calibration_month,
+        &snapshot.calibration_day, &snapshot.active_calibrations);
+    //both temperature calibrations share the same calibration points
+    calibration_points &hum = snapshot.humidity_calibration;
+    calibration_points &temp = snapshot.temperature_calibration;
+    get_calibrationdata(calibration_type::humidity, &hum.point_1_target, &hum.point_1_actual,
+        &hum.point_2_target, &hum.point_2_actual);
+    get_calibrationdata(calibration_type::temperature, &temp.point_1_target, &temp.point_1_actual,
+        &temp.point_2_target, &temp.point_2_actual);
+    snapshot.L1_unit = get_L1_unit_str();
+    get_L1_offset_gain(&snapshot.L1_offset, &snapshot.L1_gain);
+    snapshot.sensor_types = sensor_types;
+    if(sensor_types.size())
+        snapshot.sensor_values = get_sensor_data(sensor_types);
+    return snapshot;
+}
+
+DeviceSnapshot MSR_Reader::get_snapshot(const DeviceConfig &config)
+{
+    DeviceSnapshot snapshot = DeviceSnapshot();
+    MSR_SessionGuard session(*this);
+    MSR_BaudScope fast(*this, 230400);
+    //writing the names corrupts the calibration points and the L1 settings, so they are needed to write them again
+    bool names = config.name || config.calibration_name || config.calibration_year || config.calibration_month ||
+        config.calibration_day || config.active_calibrations;
+    if(names)
+    {
+        snapshot.name = get_name();
+        snapshot.calibration_name = get_calibration_name(&snapshot.calibration_year, &snapshot.calibration_month,
+            &snapshot.calibration_day, &snapshot.active_calibrations);
+    }
+    calibration_points &hum = snapshot.humidity_calibration;
+    calibration_points &temp = snapshot.temperature_calibration;
+    if(names || config.humidity_calibration)
+        get_calibrationdata(calibration_type::humidity, &hum.point_1_target, &hum.point_1_actual,
+            &hum.point_2_target, &hum.point_2_actual);
+    if(names || config.temperature_calibration)
+        get_calibrationdata(calibration_type::temperature, &temp.point_1_target, &temp.point_1_actual,
+            &temp.point_2_target, &temp.point_2_actual);
+    if(names || config.L1_unit)
+        snapshot.L1_unit = get_L1_unit_str();
+    if(names || config.L1_offset || config.L1_gain) //written together
+        get_L1_offset_gain(&snapshot.L1_offset, &snapshot.L1_gain);
+    for(uint8_t i = 0; i < 8; i++)
+    {
+        if(!config.timers[i]) continue;
+        snapshot.timers[i].interval = get_timer_interval(i);
+        get_active_measurements(i, &snapshot.timers[i].measurements, &snapshot.timers[i].blink);
+    }
+    if(config.marker_on || config.alarm_confirm_on)
+        get_marker_setting(&snapshot.marker_on, &snapshot.alarm_confirm_on);
+    if(config.limits.size())
+        snapshot.active_limits = get_general_lim_settings();
+    for(auto &limit : config.limits)
+    {
+        if(!(snapshot.active_limits & 1 << limit.type)) continue;
+        limit_entry entry;
+        entry.type = limit.type;
+        get_sample_lim_setting(entry.type, &entry.rec_settings, &entry.alarm_settings, &entry.limit1, &entry.limit2);
+        snapshot.limits.push_back(entry);
+    }
+    if(config.start_time)
+        snapshot.start_time = get_start_time();
+    if(config.end_time)
+        snapshot.end_time = get_end_time();
+    return snapshot;
+}
@@ -0,0 +1,193 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "libmsr145.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <stdexcept>
+
+//mask[i] = (low < values[i] < high) xor invert. Every stateless limit mode is one of these.
+static void inside_mask(const int16_t *values, size_t count, int32_t low, int32_t high, uint8_t invert, uint8_t *mask)
+{
+    for(size_t i = 0; i < count; i++)
+        mask[i] = ((values[i] > low) & (values[i] < high)) ^ invert;
+}
+
+static void rate_mask(const int16_t *values, const uint64_t *timestamps, size_t count, uint32_t max_rate, uint8_t *mask)
+{   //|dv| / dt > max_rate, with dt in ticks. mask[0] is set by the caller, as it needs the value before the chunk.
+    for(size_t i = 1; i < count; i++)
+    {
+        int64_t change = (int64_t)values[i] - values[i - 1];
+        if(change < 0) change = -change;
+        mask[i] = (uint64_t)change * MSR_TICKS_PER_SECOND > (uint64_t)max_rate * (timestamps[i] - timestamps[i - 1]);
+    }
+}
+
+MSR_RuleEngine::MSR_RuleEngine(const std::vector<msr_rule> &_rules, std::function<void(const rule_event &event)> _callback)
+    : rules(_rules), states(_rules.size()), columns(MSR_RULE_CHANNELS), callback(_callback)
+{
+    for(size_t i = 0; i < rules.size(); i++)
+    {
+        if((unsigned)rules[i].type >= MSR_RULE_CHANNELS)
+            throw std::invalid_argument("Rules can't be made for sampletype " + std::to_string((int)rules[i].type));
+        by_type[rules[i].type].push_back(i);
+    }
+}
+
+msr_rule MSR_RuleEngine::from_limit(const limit_entry &limit, bool alarm)
+{
+    msr_rule rule;
+    rule.type = limit.type;
+    rule.kind = rule_kind::limit;
+    rule.mode = (limit_setting)(alarm ? limit.alarm_settings : limit.rec_settings);
+    rule.limit1 = (int16_t)limit.limit1;
+    rule.limit2 = (int16_t)limit.limit2;
+    return rule;
+}
+
+void MSR_RuleEngine::reset()
+{
+    for(auto &state : states) state = rule_state();
+    for(auto &cur_column : columns) cur_column.count = 0;
+}
+
+void MSR_RuleEngine::evaluate(sampletype type, const int16_t *values, const uint64_t *timestamps, size_t count)
+{
+    if((unsigned)type >= MSR_RULE_CHANNELS || by_type[type].empty()) return;
+    for(size_t start = 0; start < count; start += MSR_RULE_CHUNK)
+    {
+        size_t chunk = std::min<size_t>(MSR_RULE_CHUNK, count - start);
+        for(auto index : by_type[type])
+            evaluate_rule(index, values + start, timestamps + start, chunk);
+    }
+    evaluated += count;
+}
+
+void MSR_RuleEngine::flush(sampletype type)
+{
+    column &cur_column = columns[type];
+    evaluate(type, cur_column.values, cur_column.timestamps, cur_column.count);
+    cur_column.count = 0;
+}
+
+void MSR_RuleEngine::evaluate(const std::vector<sample> &samples)
+{   //the samples of the channels are interleaved, so they are gathered into columns first
+    for(auto &cur_sample : samples)
+    {
+        if((unsigned)cur_sample.type >= MSR_RULE_CHANNELS || by_type[cur_sample.type].empty()) continue;
+        column &cur_column = columns[cur_sample.type];
+        cur_column.values[cur_column.count] = cur_sample.value;
+        cur_column.timestamps[cur_column.count] = cur_sample.timestamp;
+        if(++cur_column.count == MSR_RULE_CHUNK)
+            flush(cur_sample.type);
+    }
+    for(unsigned type = 0; type < MSR_RULE_CHANNELS; type++)
+        if(columns[type].count)
+            flush((sampletype)type);
+}
+
+void MSR_RuleEngine::evaluate(const live_reading &reading, const sampletype *types)
+{
+    uint64_t timestamp = std::chrono::duration_cast<std::chrono::duration<uint64_t, std::ratio<1, MSR_TICKS_PER_SECOND> > >(
+        reading.time.time_since_epoch()).count();
+    for(size_t i = 0; i < reading.count; i++)
+        evaluate(types[i], &reading.values[i], &timestamp, 1);
+}
+
+void MSR_RuleEngine::evaluate_rule(size_t index, const int16_t *values, const uint64_t *timestamps, size_t count)
+{
+    const msr_rule &rule = rules[index];
+    rule_state &state = states[index];
+    uint8_t mask[MSR_RULE_CHUNK];
+    //the condition of each sample
+    if(rule.kind == rule_kind::rate_of_change)
+    {
+        mask[0] = state.have_last && (uint64_t)std::abs((int64_t)values[0] - state.last_value) * MSR_TICKS_PER_SECOND >
+            (uint64_t)rule.max_rate * (timestamps[0] - state.last_time);
+        rate_mask(values, timestamps, count, rule.max_rate, mask);
+        state.have_last = true;
+        state.last_value = values[count - 1];
+        state.last_time = timestamps[count - 1];
+    }
+    else
+    {
+        switch(rule.mode)
+        {
+            case rec_less_limit2:
+                inside_mask(values, count, INT32_MIN, rule.limit2, 0, mask);
+                break;
+            case rec_more_limit2:
+                inside_mask(values, count, rule.limit2, INT32_MAX, 0, mask);
+                break;
+            case alarm_less_limit1:
+                inside_mask(values, count, INT32_MIN, rule.limit1, 0, mask);
+                break;
+            case alarm_more_limit1:
+                inside_mask(values, count, rule.limit1, INT32_MAX, 0, mask);
+                break;
+            case rec_more_limit1_and_less_limit2: case alarm_more_limit1_and_less_limit2:
+                inside_mask(values, count, rule.limit1, rule.limit2, 0, mask);
+                break;
+            case rec_less_limit1_or_more_limit2: case alarm_less_limit1_or_more_limit2:
+                //not L1 <= S <= L2
+                inside_mask(values, count, (int32_t)rule.limit1 - 1, (int32_t)rule.limit2 + 1, 1, mask);
+                break;
+            case rec_start_more_limit1_stop_less_limit2: case rec_start_less_limit1_stop_more_limit2:
+            {   //starts when the first limit is passed, and stops when the second is
+                bool start_above = rule.mode == rec_start_more_limit1_stop_less_limit2;
+                uint8_t stop[MSR_RULE_CHUNK];
+                if(start_above)
+                {
+                    inside_mask(values, count, rule.limit1, INT32_MAX, 0, mask);
+                    inside_mask(values, count, INT32_MIN, rule.limit2, 0, stop);
+                }
+                else
+                {
+                    inside_mask(values, count, INT32_MIN, rule.limit1, 0, mask);
+                    inside_mask(values, count, rule.limit2, INT32_MAX, 0, stop);
+                }
+                uint8_t condition = state.condition;
+                for(size_t i = 0; i < count; i++)
+                    mask[i] = condition = condition ? !stop[i] : mask[i];
+                break;
+            }
+            default: //no_limit
+                std::fill(mask, mask + count, 0);
+                break;
+        }
+    }
+    //most chunks don't change the state of the rule, which is found without walking them
+    uint8_t differs = 0;
+    for(size_t i = 0; i < count; i++)
+        differs |= mask[i] ^ (uint8_t)state.condition;
+    if(!differs && (!state.condition || state.active || timestamps[count - 1] - state.since < rule.min_duration))
+        return;
+    for(size_t i = 0; i < count; i++)
+    {
+        bool condition = mask[i];
+        if(condition != state.condition)
+        {
+            state.condition = condition;
+            state.since = timestamps[i];
+            if(!condition && state.active)
+            {
+                state.active = false;
+                events++;
+                if(callback) callback({index, false, rule.type, values[i], timestamps[i]});
+            }
+        }
+        if(condition && !state.active && timestamps[i] - state.since >= rule.min_duration)
+        {
+            state.active = true;
+            events++;
+            if(callback) callback({index, true, rule.type, values[i], timestamps[i]});
+        }
+    }
+}
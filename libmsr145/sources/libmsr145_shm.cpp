@@ -0,0 +1,137 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "libmsr145.hpp"
+#include <cstring>
+#include <stdexcept>
+
+MSR_ShmPublisher::MSR_ShmPublisher(MSR_Reader &_device, const std::vector<sampletype> &_types,
+    std::chrono::microseconds _interval, std::string name) : device(_device), types(_types), interval(_interval), errors(0)
+{
+    for(auto type : types)
+        if((unsigned)type >= MSR_SHM_CHANNELS)
+            throw std::invalid_argument("Sampletype " + std::to_string((int)type) + " can't be published");
+    std::string serial = device.get_serial();
+    shm_name = name.size() ? name : MSR_SHM_PREFIX + serial;
+    //a segment left by a publisher which didn't exit cleanly is reused
+    fd = shm_open(shm_name.c_str(), O_CREAT | O_RDWR, 0644);
+    if(fd < 0)
+        throw std::runtime_error("Could not create the shared memory segment " + shm_name + ": " + strerror(errno));
+    if(ftruncate(fd, sizeof(msr_shm_segment)) != 0)
+    {
+        close(fd);
+        shm_unlink(shm_name.c_str());
+        throw std::runtime_error("Could not resize the shared memory segment " + shm_name + ": " + strerror(errno));
+    }
+    void *map = mmap(nullptr, sizeof(msr_shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        close(fd);
+        shm_unlink(shm_name.c_str());
+        throw std::runtime_error("Could not map the shared memory segment " + shm_name + ": " + strerror(errno));
+    }
+    segment = (msr_shm_segment *)map;
+    //readers check the magic before anything else, so it is cleared while the rest is set up
+    segment->magic.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    segment->version = MSR_SHM_VERSION;
+    memset(segment->serial, 0, sizeof(segment->serial));
+    strncpy(segment->serial, serial.c_str(), sizeof(segment->serial) - 1);
+    segment->publisher_pid.store(getpid(), std::memory_order_relaxed);
+    for(auto &channel : segment->channels)
+    {
+        channel.sequence.store(0, std::memory_order_relaxed);
+        channel.value.store(0, std::memory_order_relaxed);
+        channel.time_ns.store(0, std::memory_order_relaxed);
+        channel.updates.store(0, std::memory_order_relaxed);
+    }
+    segment->magic.store(MSR_SHM_MAGIC, std::memory_order_release);
+}
+
+MSR_ShmPublisher::~MSR_ShmPublisher()
+{
+    stop();
+    segment->publisher_pid.store(0, std::memory_order_relaxed);
+    munmap(segment, sizeof(msr_shm_segment));
+    close(fd);
+    //readers which have it mapped keep the memory, new readers won't find it
+    shm_unlink(shm_name.c_str());
+}
+
+void MSR_ShmPublisher::start()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    if(running || types.empty() || interval.count() <= 0) return;
+    running = true;
+    thread = std::thread(&MSR_ShmPublisher::poll, this);
+}
+
+void MSR_ShmPublisher::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if(!running) return;
+        running = false;
+    }
+    stop_requested.notify_all();
+    thread.join();
+}
+
+void MSR_ShmPublisher::publish(const sampletype *sample_types, size_t count, const int16_t *values,
+    std::chrono::system_clock::time_point time)
+{
+    int64_t time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    std::lock_guard<std::mutex> guard(publish_mutex);
+    for(size_t i = 0; i < count; i++)
+    {
+        if((unsigned)sample_types[i] >= MSR_SHM_CHANNELS) continue;
+        msr_shm_channel &channel = segment->channels[sample_types[i]];
+        uint32_t sequence = channel.sequence.load(std::memory_order_relaxed);
+        channel.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release); //the odd sequence is seen before any of the new fields
+        channel.value.store(values[i], std::memory_order_relaxed);
+        channel.time_ns.store(time_ns, std::memory_order_relaxed);
+        channel.updates.store(channel.updates.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        channel.sequence.store(sequence + 2, std::memory_order_release);
+    }
+}
+
+bool MSR_ShmPublisher::get_latest(sampletype type, shm_reading &reading)
+{
+    if((unsigned)type >= MSR_SHM_CHANNELS) return false;
+    std::lock_guard<std::mutex> guard(publish_mutex); //nothing is being written then
+    return msr_shm_try_read(segment->channels[type], reading);
+}
+
+void MSR_ShmPublisher::poll()
+{
+    MSR_PriorityScope scope(command_priority::live);
+    std::vector<int16_t> values(types.size());
+    auto next = std::chrono::steady_clock::now();
+    while(true)
+    {
+        try
+        {
+            device.get_sensor_data(types.data(), types.size(), values.data());
+            publish(types.data(), types.size(), values.data());
+        }
+        catch(std::exception &)
+        {   //also errors of the port, e.g. when the device is unplugged.
+            //The old values stay, their timestamps tell the readers how old they are
+            errors++;
+        }
+        next += interval;
+        auto now = std::chrono::steady_clock::now();
+        if(now > next) //don't catch up on the reads we were too late for
+            next += interval * ((now - next) / interval + 1);
+        std::unique_lock<std::mutex> lock(mutex);
+        if(stop_requested.wait_until(lock, next, [this] () { return !running; }))
+            return;
+    }
+}
@@ -0,0 +1,342 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "libmsr145_transport.hpp"
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <thread> //sleep_until
+#include <boost/optional.hpp>
+#include <boost/system/error_code.hpp>
+#include <termios.h> //tcflush
+#include <glob.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+using namespace boost::asio;
+using namespace boost::posix_time;
+
+
+template<class Stream> static size_t read_with_timeout(io_service &ioservice, Stream &stream,
+    uint8_t *data, size_t length, time_duration time_out)
+{   //Read length bytes from stream. Returns the number of bytes read before time_out.
+    if(length == 0) return 0;
+    boost::optional<boost::system::error_code> timer_result;
+    boost::asio::deadline_timer timer(ioservice);
+    timer.expires_from_now(time_out);
+    timer.async_wait([&timer_result] (const boost::system::error_code& error) { timer_result.reset(error); });
+
+    boost::optional<boost::system::error_code> read_result;
+    size_t read_bytes = 0;
+    boost::asio::async_read(stream, buffer(data, length), transfer_exactly(length),
+        [&read_result, &read_bytes] (const boost::system::error_code& error, size_t transferred)
+        { read_result.reset(error); read_bytes = transferred; });
+
+    ioservice.reset();
+    while (ioservice.run_one())
+    {
+        if (read_result)
+            timer.cancel();
+        else if (timer_result)
+            stream.cancel();
+    }
+    return read_bytes;
+}
+
+static size_t read_available(int fd, uint8_t *data, size_t length)
+{   //Reads the bytes which have already been received, up to length
+    size_t read_bytes = 0;
+    while(read_bytes < length)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, 0);
+        if(ready < 0 && errno == EINTR) continue;
+        if(ready <= 0) break;
+        ssize_t count = ::read(fd, data + read_bytes, length - read_bytes);
+        if(count < 0 && errno == EINTR) continue;
+        if(count <= 0) break;
+        read_bytes += count;
+    }
+    return read_bytes;
+}
+
+MSR_SerialTransport::MSR_SerialTransport(std::string portname)
+{
+    //open the port and setup baudrate, stop bits and word length
+    this->port = new serial_port(ioservice, portname);
+    this->port->set_option(serial_port_base::baud_rate( MSR_BUAD_RATE ));
+    this->port->set_option(serial_port_base::stop_bits( MSR_STOP_BITS ));
+    this->port->set_option(serial_port_base::character_size( MSR_WORD_length ));
+    this->port->set_option(serial_port::flow_control(serial_port::flow_control::none));
+}
+
+MSR_SerialTransport::~MSR_SerialTransport()
+{
+    delete port;
+}
+
+void MSR_SerialTransport::write(const uint8_t *data, size_t length)
+{
+    boost::asio::write(*(this->port), buffer(data, length));
+}
+
+size_t MSR_SerialTransport::read(uint8_t *data, size_t length, time_duration time_out)
+{   //Wait for the bytes with poll, as the asynchronous read of asio allocates for every read
+    int fd = this->port->native_handle();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(time_out.total_microseconds());
+    size_t read_bytes = 0;
+    while(read_bytes < length)
+    {
+        int wait_ms = -1;
+        if(!time_out.is_pos_infinity())
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+            if(remaining.count() <= 0) break;
+            wait_ms = (remaining.count() + 999) / 1000;
+        }
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, wait_ms);
+        if(ready < 0 && errno == EINTR) continue;
+        if(ready <= 0) break;
+        ssize_t count = ::read(fd, data + read_bytes, length - read_bytes);
+        if(count < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        if(count <= 0) break;
+        read_bytes += count;
+    }
+    return read_bytes;
+}
+
+size_t MSR_SerialTransport::read_some(uint8_t *data, size_t length)
+{
+    return read_available(this->port->native_handle(), data, length);
+}
+
+void MSR_SerialTransport::set_baud(uint32_t baudrate)
+{
+    this->port->set_option(serial_port_base::baud_rate( baudrate ));
+}
+
+void MSR_SerialTransport::drain()
+{
+    tcflush(this->port->native_handle(), TCIFLUSH);
+}
+
+
+
+MSR_TcpTransport::MSR_TcpTransport(std::string host, std::string port, time_duration _extra_timeout)
+{
+    this->extra_timeout = _extra_timeout;
+    ip::tcp::resolver resolver(ioservice);
+    this->socket = new ip::tcp::socket(ioservice);
+    boost::asio::connect(*(this->socket), resolver.resolve(ip::tcp::resolver::query(host, port)));
+    //Commands are tiny and we always wait for the answer, so don't let Nagle delay them.
+    this->socket->set_option(ip::tcp::no_delay(true));
+    this->socket->set_option(socket_base::keep_alive(true));
+}
+
+MSR_TcpTransport::~MSR_TcpTransport()
+{
+    delete socket;
+}
+
+void MSR_TcpTransport::flush()
+{
+    if(pending.size() == 0) return;
+    boost::asio::write(*(this->socket), buffer(pending));
+    pending.clear();
+}
+
+void MSR_TcpTransport::write(const uint8_t *data, size_t length)
+{   //Coalesce writes until we need an answer
+    pending.insert(pending.end(), data, data + length);
+}
+
+size_t MSR_TcpTransport::read(uint8_t *data, size_t length, time_duration time_out)
+{
+    flush();
+    return read_with_timeout(this->ioservice, *(this->socket), data, length, time_out);
+}
+
+size_t MSR_TcpTransport::read_some(uint8_t *data, size_t length)
+{
+    return read_available(this->socket->native_handle(), data, length);
+}
+
+void MSR_TcpTransport::drain()
+{
+    std::vector<uint8_t> stale;
+    while(this->socket->available())
+    {
+        stale.resize(this->socket->available());
+        this->socket->read_some(buffer(stale));
+    }
+}
+
+void MSR_TcpTransport::set_baud(__attribute__((unused)) uint32_t baudrate)
+{   //The baudrate is set on the serial server.
+}
+
+
+void MSR_MemoryTransport::write(const uint8_t *data, size_t length)
+{
+    auto response = responder(std::vector<uint8_t>(data, data + length));
+    received.insert(received.end(), response.begin(), response.end());
+}
+
+size_t MSR_MemoryTransport::read(uint8_t *data, size_t length, __attribute__((unused)) time_duration time_out)
+{
+    size_t read_bytes = std::min(length, received.size());
+    std::copy(received.begin(), received.begin() + read_bytes, data);
+    received.erase(received.begin(), received.begin() + read_bytes);
+    return read_bytes;
+}
+
+
+MSR_CaptureTransport::MSR_CaptureTransport(MSR_Transport *_transport, std::string filename)
+{
+    this->transport = _transport;
+    this->trace.open(filename, std::ios::out);
+    if(!this->trace.is_open())
+        throw std::runtime_error("Could not open trace file " + filename);
+    this->trace << "# msr145 trace v1" << std::endl;
+    this->start = std::chrono::steady_clock::now();
+}
+
+MSR_CaptureTransport::~MSR_CaptureTransport()
+{
+    delete transport;
+}
+
+void MSR_CaptureTransport::write_event(char type, const std::string &args, const uint8_t *data, size_t length)
+{
+    auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    this->trace << type << " " << time.count() << " " << args;
+    char hex[3];
+    for(size_t i = 0; i < length; i++)
+    {
+        snprintf(hex, sizeof(hex), "%02X", data[i]);
+        this->trace << hex;
+    }
+    this->trace << "\n";
+}
+
+void MSR_CaptureTransport::write(const uint8_t *data, size_t length)
+{
+    write_event('W', "", data, length);
+    transport->write(data, length);
+}
+
+size_t MSR_CaptureTransport::read(uint8_t *data, size_t length, time_duration time_out)
+{
+    size_t read_bytes = transport->read(data, length, time_out);
+    write_event('R', std::to_string(length) + " ", data, read_bytes);
+    return read_bytes;
+}
+
+void MSR_CaptureTransport::set_baud(uint32_t baudrate)
+{
+    write_event('B', std::to_string(baudrate), nullptr, 0);
+    transport->set_baud(baudrate);
+}
+
+
+MSR_ReplayTransport::MSR_ReplayTransport(std::string filename, bool _realtime)
+{
+    this->realtime = _realtime;
+    std::ifstream trace(filename);
+    if(!trace.is_open())
+        throw std::runtime_error("Could not open trace file " + filename);
+    std::string line;
+    while(std::getline(trace, line))
+    {
+        if(line.size() == 0 || line[0] == '#') continue;
+        std::istringstream line_stream(line);
+        trace_event event;
+        std::string hex;
+        line_stream >> event.type >> event.time;
+        event.value = 0;
+        if(event.type == 'R' || event.type == 'B') line_stream >> event.value;
+        line_stream >> hex;
+        for(size_t i = 0; i + 1 < hex.size(); i += 2)
+            event.data.push_back(std::stoul(hex.substr(i, 2), nullptr, 16));
+        events.push_back(event);
+    }
+    this->start = std::chrono::steady_clock::now();
+}
+
+MSR_ReplayTransport::trace_event &MSR_ReplayTransport::get_event(char type)
+{
+    if(next_event >= events.size())
+        throw std::runtime_error("Replay: the trace has ended");
+    trace_event &event = events[next_event++];
+    if(event.type != type)
+        throw std::runtime_error("Replay: the trace has event " + std::string(1, event.type) +
+            " at event " + std::to_string(next_event) + ", but " + std::string(1, type) + " was requested");
+    if(realtime)
+        std::this_thread::sleep_until(start + std::chrono::microseconds(event.time));
+    return event;
+}
+
+void MSR_ReplayTransport::write(const uint8_t *data, size_t length)
+{
+    trace_event &event = get_event('W');
+    if(event.data.size() != length || memcmp(event.data.data(), data, length) != 0)
+        throw std::runtime_error("Replay: written frame differs from the trace at event " + std::to_string(next_event));
+}
+
+size_t MSR_ReplayTransport::read(uint8_t *data, size_t length, __attribute__((unused)) time_duration time_out)
+{
+    trace_event &event = get_event('R');
+    if(event.value != length)
+        throw std::runtime_error("Replay: read length differs from the trace at event " + std::to_string(next_event));
+    if(event.data.size() > length) //a damaged trace
+        throw std::runtime_error("Replay: the trace has more bytes than were read at event " + std::to_string(next_event));
+    memcpy(data, event.data.data(), event.data.size());
+    return event.data.size();
+}
+
+void MSR_ReplayTransport::set_baud(uint32_t baudrate)
+{
+    trace_event &event = get_event('B');
+    if(event.value != baudrate)
+        throw std::runtime_error("Replay: baudrate differs from the trace at event " + std::to_string(next_event));
+}
+
+
+MSR_Transport *open_transport(std::string name)
+{
+    if(name.compare(0, 4, "tcp:") == 0)
+    {
+        auto colon = name.rfind(':');
+        if(colon <= 4)
+            throw std::runtime_error("TCP device must be given as tcp:<host>:<port>");
+        return new MSR_TcpTransport(name.substr(4, colon - 4), name.substr(colon + 1));
+    }
+    if(name.compare(0, 7, "replay:") == 0)
+        return new MSR_ReplayTransport(name.substr(7), false);
+    if(name.compare(0, 10, "replay-rt:") == 0)
+        return new MSR_ReplayTransport(name.substr(10), true);
+    return new MSR_SerialTransport(name);
+}
+
+std::vector<std::string> expand_port_patterns(const std::vector<std::string> &patterns)
+{
+    std::vector<std::string> ports;
+    for(auto &pattern : patterns)
+    {
+        glob_t matches;
+        if(glob(pattern.c_str(), 0, nullptr, &matches) == 0)
+            ports.insert(ports.end(), matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+        else
+            ports.push_back(pattern);
+        globfree(&matches);
+    }
+    return ports;
+}
@@ -0,0 +1,83 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "libmsr145_units.hpp"
+#include <stdexcept>
+#include <string>
+
+double msr_unit_scale(sampletype type)
+{   //multiplying by the reciprocal in double gives the same floats as dividing, for all 16 bit values
+    switch(type)
+    {
+        case pressure: //mbar
+        case T_pressure: //C
+            return 1 / 10.;
+        case humidity: //%
+        case T_humidity: //C
+            return 1 / 100.;
+        case bat:
+            //volts. There is a pretty weird conversion factor for some reason.
+            //The factor is not really vertified to be "the correct one".
+            return 1 / 682.5;
+        case light:
+            return 6.5865478515625;
+        case ext1: case ext2: case ext3: case ext4:
+            return 1;
+        default:
+            throw std::invalid_argument("Sampletype " + std::to_string((int)type) + " has no unit");
+    }
+}
+
+unit_conversion msr_unit_conversion(sampletype type, float conversion_factor, float offset)
+{
+    unit_conversion conversion;
+    conversion.scale = conversion_factor != 0 ? conversion_factor : msr_unit_scale(type);
+    conversion.offset = offset;
+    return conversion;
+}
+
+unit_conversion msr_unit_table(const std::function<float(int16_t value)> &mapping)
+{
+    std::shared_ptr<std::vector<float> > table(new std::vector<float>(MSR_UNIT_TABLE_SIZE));
+    for(size_t i = 0; i < MSR_UNIT_TABLE_SIZE; i++)
+        (*table)[i] = mapping((int16_t)(uint16_t)i);
+    unit_conversion conversion;
+    conversion.table = table;
+    return conversion;
+}
+
+void msr_convert_column(const unit_conversion &conversion, const int16_t *values, size_t count, float *out)
+{
+    if(conversion.table)
+    {
+        const float *table = conversion.table->data();
+        for(size_t i = 0; i < count; i++)
+            out[i] = table[(uint16_t)values[i]];
+        return;
+    }
+    const double scale = conversion.scale;
+    const float offset = conversion.offset;
+    for(size_t i = 0; i < count; i++)
+        out[i] = (float)(values[i] * scale) + offset;
+}
+
+void msr_convert_column(const unit_conversion &conversion, const int16_t *values, size_t count, double *out)
+{
+    if(conversion.table)
+    {
+        const float *table = conversion.table->data();
+        for(size_t i = 0; i < count; i++)
+            out[i] = table[(uint16_t)values[i]];
+        return;
+    }
+    const double scale = conversion.scale;
+    const double offset = conversion.offset;
+    for(size_t i = 0; i < count; i++)
+        out[i] = values[i] * scale + offset;
+}
@@ -11,6 +11,13 @@
 #include <string>
 #include <cstdio>
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <thread> //sleep_for
+#include <boost/algorithm/string.hpp>
+
+#define MSR_ERASE_ATTEMPTS 20 //busy answers to an erase command, each after the retry budget, before giving up
+#define MSR_ERASE_TIMEOUT std::chrono::seconds(5) //a sector takes ~100 ms to erase
 
 void MSR_Writer::insert_time_in_command(struct tm *timeset, uint8_t *command)
 {
@@ -29,11 +36,45 @@ void MSR_Writer::stop_recording()
 }
 
 
-void MSR_Writer::format_memory()
-{
+void MSR_Writer::format_memory(bool fast)
+{   //If fast is set, only the sectors used by the recordings on the device is erased.
+    //Else every sector is erased, which takes a couple of minutes.
+    MSR_SessionGuard session(*this);
     stop_recording(); //stop current recording before format.
-    uint16_t start_address = 0x0000;
-    uint16_t end_address = 0x03FF;
+    std::vector<uint16_t> sectors;
+    if(fast)
+    {
+        sectors = get_used_sectors();
+        if(sectors.size() == 0) return;
+    }
+    else
+    {
+        for(uint16_t addr = 0x0000; addr <= 0x03FF; addr++)
+            sectors.push_back(addr);
+    }
+    //the full format is done at 9600, as always. The baudrate is set back if an erase fails.
+    MSR_BaudScope baud(*this, fast ? 230400 : get_baud());
+    erase_sectors(sectors);
+}
+
+std::vector<uint16_t> MSR_Writer::get_used_sectors()
+{   //The memory consists of 0x2000 pages, and is erased in sectors of 8 pages.
+    //Find the sectors which contains pages used by a recording.
+    std::vector<bool> dirty(0x400, false);
+    for(auto &record : get_rec_list())
+    {
+        //also include the page after the recording, in case the device have started writing to it.
+        for(uint32_t i = 0; i <= record.length; i++)
+            dirty[((record.address + i) % 0x2000) >> 3] = true;
+    }
+    std::vector<uint16_t> sectors;
+    for(uint16_t sector = 0; sector < dirty.size(); sector++)
+        if(dirty[sector]) sectors.push_back(sector);
+    return sectors;
+}
+
+void MSR_Writer::erase_sectors(const std::vector<uint16_t> &sectors)
+{
     uint8_t erase_cmd[] = {0x8A, 0x06, 0x00,
         0x00 /*adress lsb*/, 0x00 /*address msb*/,
         0x5A, 0xA5};
@@ -41,21 +82,33 @@ void MSR_Writer::format_memory()
     this->send_command(start_cmd1, sizeof(start_cmd1), nullptr, 8);
 
     uint8_t confirm_command[] = {0x8A, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00};
-    uint8_t *returnval = new uint8_t[8];
-    for(uint16_t addr = start_address; addr <= end_address; addr++)
+    std::vector<uint8_t> returnval(8);
+    //Instead of polling for the confirmation in a tight loop, wait for most of the time the last erase took,
+    //and then poll with an increasing interval.
+    auto expected_erase_time = std::chrono::microseconds(0);
+    for(auto addr : sectors)
     {
         erase_cmd[3] = addr & 0xFF;
         erase_cmd[4] = addr >> 8;
-        bool success = false;
-        while(!success)
-            if(this->send_command(erase_cmd, sizeof(erase_cmd), returnval, 8) == 0)
-                success = true;
-        do
+        int attempts = 0;
+        while(this->send_command(erase_cmd, sizeof(erase_cmd), returnval.data(), 8) != 0)
+            if(++attempts >= MSR_ERASE_ATTEMPTS)
+                throw msr_error("The device stays busy on the erase of sector " + std::to_string(addr), erase_cmd[0]);
+        auto erase_start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(expected_erase_time * 3 / 4);
+        auto poll_interval = std::chrono::microseconds(500);
+        while(true)
         {
-            this->send_command(confirm_command, sizeof(confirm_command), returnval, 8);
-        } while(returnval[1] != 0xBC);
+            this->send_command(confirm_command, sizeof(confirm_command), returnval.data(), 8);
+            if(returnval[1] == 0xBC) break;
+            if(std::chrono::steady_clock::now() - erase_start > MSR_ERASE_TIMEOUT)
+                throw msr_timeout_error("The erase of sector " + std::to_string(addr) + " was never confirmed", confirm_command[0]);
+            std::this_thread::sleep_for(poll_interval);
+            poll_interval = std::min(poll_interval * 2, std::chrono::microseconds(20000));
+        }
+        auto erase_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - erase_start);
+        expected_erase_time = (expected_erase_time + erase_time) / 2;
     }
-    delete[] returnval;
 }
 
 
@@ -97,6 +150,23 @@ int MSR_Writer::set_names_and_calibration_date(std::string deviceName, std::stri
     get_L1_offset_gain(&L1_offset, &L1_gain);
     std::string L1_unit = get_L1_unit_str();
 
+    int returnval = write_names_and_calibration_date(deviceName, calibrationName, year, month, day, active_calib);
+
+    //set the read calibrations
+    set_L1_unit(L1_unit);
+    set_L1_offset_gain(L1_offset, L1_gain);
+    for(int i = 0; i < 2; i++)
+    {
+        set_calibrationdata(calibration_type::calibration_type(calibpoints[i][0]), calibpoints[i][1], calibpoints[i][2], calibpoints[i][3], calibpoints[i][4]);
+    }
+
+    return returnval;
+}
+
+int MSR_Writer::write_names_and_calibration_date(std::string deviceName, std::string calibrationName,
+    uint8_t year, uint8_t month, uint8_t day, uint8_t active_calib)
+{   //Only writes the names and date. The calibration points and L1 settings is corrupted afterwards,
+    //so the caller needs to write them again.
     while(deviceName.size() < 12)
         deviceName.push_back(' ');
     while(calibrationName.size() < 8)
@@ -120,15 +190,6 @@ int MSR_Writer::set_names_and_calibration_date(std::string deviceName, std::stri
     returnval |= this->send_command(command_5, sizeof(command_5), nullptr, 8);
     returnval |= this->send_command(command_6, sizeof(command_6), nullptr, 8);
     returnval |= this->send_command(command_7, sizeof(command_7), nullptr, 8);
-
-    //set the read calibrations
-    set_L1_unit(L1_unit);
-    set_L1_offset_gain(L1_offset, L1_gain);
-    for(int i = 0; i < 2; i++)
-    {
-        set_calibrationdata(calibration_type::calibration_type(calibpoints[i][0]), calibpoints[i][1], calibpoints[i][2], calibpoints[i][3], calibpoints[i][4]);
-    }
-
     return returnval;
 }
 
@@ -212,13 +273,26 @@ int MSR_Writer::set_timer_measurements(uint8_t t, uint8_t bitmask, bool blink, b
 int MSR_Writer::set_limit(sampletype type, uint16_t limit1, uint16_t limit2,
     limit_setting record_limit, limit_setting alarm_limit)
 {
-    uint8_t type_byte = type;
-    uint8_t limit_setting_byte = record_limit | alarm_limit;
-    uint8_t set_limit1[] = {0x89, 0x0A, type_byte, limit_setting_byte, 0x00, (uint8_t)(limit1 & 0xFF), (uint8_t)(limit1 >> 8)};
-    uint8_t set_limit2[] = {0x89, 0x0B, type_byte, 0x00, 0x00, (uint8_t)(limit2 & 0xFF), (uint8_t)(limit2  >> 8)};
+    limit_entry limit;
+    limit.type = type;
+    limit.rec_settings = record_limit;
+    limit.alarm_settings = alarm_limit;
+    limit.limit1 = limit1;
+    limit.limit2 = limit2;
+    return write_limit(limit, true, true);
+}
+
+int MSR_Writer::write_limit(const limit_entry &limit, bool write_limit1, bool write_limit2)
+{   //L1 is written together with the limit settings, L2 is written alone.
+    uint8_t type_byte = limit.type;
+    uint8_t limit_setting_byte = limit.rec_settings | limit.alarm_settings;
+    uint8_t set_limit1[] = {0x89, 0x0A, type_byte, limit_setting_byte, 0x00, (uint8_t)(limit.limit1 & 0xFF), (uint8_t)(limit.limit1 >> 8)};
+    uint8_t set_limit2[] = {0x89, 0x0B, type_byte, 0x00, 0x00, (uint8_t)(limit.limit2 & 0xFF), (uint8_t)(limit.limit2  >> 8)};
     int returnval = 0;
-    returnval |= this->send_command(set_limit1, sizeof(set_limit1), nullptr, 8);
-    returnval |= this->send_command(set_limit2, sizeof(set_limit2), nullptr, 8);
+    if(write_limit1)
+        returnval |= this->send_command(set_limit1, sizeof(set_limit1), nullptr, 8);
+    if(write_limit2)
+        returnval |= this->send_command(set_limit2, sizeof(set_limit2), nullptr, 8);
     return returnval;
 }
 
@@ -266,3 +340,135 @@ int MSR_Writer::set_L1_offset_gain(float offset, float gain)
     returnval |= this->send_command(cmd2, sizeof(cmd2), nullptr, 8);
     return returnval;
 }
+
+static bool same_time(const struct tm &t1, const struct tm &t2)
+{   //only compares the fields which are saved on the device
+    return t1.tm_sec == t2.tm_sec && t1.tm_min == t2.tm_min && t1.tm_hour == t2.tm_hour &&
+        t1.tm_mday == t2.tm_mday && t1.tm_mon == t2.tm_mon && t1.tm_year == t2.tm_year;
+}
+
+static bool same_points(const calibration_points &p1, const calibration_points &p2)
+{
+    return p1.point_1_target == p2.point_1_target && p1.point_1_actual == p2.point_1_actual &&
+        p1.point_2_target == p2.point_2_target && p1.point_2_actual == p2.point_2_actual;
+}
+
+static float truncate_float24(float value)
+{   //The device only saves the upper 24 bits of the L1 offset and gain.
+    //BEWARE THIS ONLY WORK ON LITTLE ENDIAN.
+    uint8_t *value_ptr = (uint8_t *)&value;
+    value_ptr[0] = 0x00;
+    return value;
+}
+
+static std::string pad_str(std::string str, size_t length)
+{
+    str.resize(length, ' ');
+    return str;
+}
+
+std::vector<std::function<int()> > MSR_Writer::diff_config(const DeviceConfig &config, const DeviceSnapshot &current)
+{   //Returns the writes needed to bring the device from current to config.
+    std::vector<std::function<int()> > writes;
+
+    //The names, calibration date and active calibrations have to be written together.
+    //Writing them corrupts the calibration points and the L1 settings, so these have to be written again.
+    std::string name = pad_str(config.name.value_or(current.name), 12);
+    std::string calib_name = pad_str(config.calibration_name.value_or(current.calibration_name), 8);
+    uint8_t year = config.calibration_year.value_or(current.calibration_year);
+    uint8_t month = config.calibration_month.value_or(current.calibration_month);
+    uint8_t day = config.calibration_day.value_or(current.calibration_day);
+    uint8_t active_calib = config.active_calibrations.value_or(current.active_calibrations);
+    bool names_dirty = name != pad_str(current.name, 12) || calib_name != pad_str(current.calibration_name, 8) ||
+        year != current.calibration_year || month != current.calibration_month ||
+        day != current.calibration_day || active_calib != current.active_calibrations;
+    if(names_dirty)
+        writes.push_back([=]() { return write_names_and_calibration_date(name, calib_name, year, month, day, active_calib); });
+
+    calibration_points hum = config.humidity_calibration.value_or(current.humidity_calibration);
+    if(names_dirty || !same_points(hum, current.humidity_calibration))
+        writes.push_back([=]() { return set_calibrationdata(calibration_type::humidity,
+            hum.point_1_target, hum.point_1_actual, hum.point_2_target, hum.point_2_actual); });
+    calibration_points temp = config.temperature_calibration.value_or(current.temperature_calibration);
+    if(names_dirty || !same_points(temp, current.temperature_calibration))
+        writes.push_back([=]() { return set_calibrationdata(calibration_type::temperature,
+            temp.point_1_target, temp.point_1_actual, temp.point_2_target, temp.point_2_actual); });
+
+    std::string unit = boost::trim_copy(config.L1_unit.value_or(current.L1_unit));
+    if(names_dirty || unit != boost::trim_copy(current.L1_unit))
+        writes.push_back([=]() { return set_L1_unit(unit); });
+    float offset = config.L1_offset.value_or(current.L1_offset);
+    float gain = config.L1_gain.value_or(current.L1_gain);
+    if(names_dirty || truncate_float24(offset) != current.L1_offset || truncate_float24(gain) != current.L1_gain)
+        writes.push_back([=]() { return set_L1_offset_gain(offset, gain); });
+
+    for(uint8_t t = 0; t < 8; t++)
+    {
+        if(!config.timers[t]) continue;
+        timer_setting timer = *config.timers[t];
+        if(timer.interval != current.timers[t].interval)
+            writes.push_back([=]() { return set_timer_interval(t, timer.interval); });
+        if(timer.measurements != current.timers[t].measurements || timer.blink != current.timers[t].blink)
+            writes.push_back([=]() { return set_timer_measurements(t, timer.measurements, timer.blink,
+                timer.measurements || timer.blink); });
+    }
+
+    bool marker_on = config.marker_on.value_or(current.marker_on);
+    bool alarm_confirm_on = config.alarm_confirm_on.value_or(current.alarm_confirm_on);
+    if(marker_on != current.marker_on || alarm_confirm_on != current.alarm_confirm_on)
+        writes.push_back([=]() { return set_marker_settings(marker_on, alarm_confirm_on); });
+
+    for(auto &limit : config.limits)
+    {
+        auto cur = std::find_if(current.limits.begin(), current.limits.end(),
+            [&limit](const limit_entry &entry) { return entry.type == limit.type; });
+        bool write_limit1, write_limit2;
+        if(cur == current.limits.end())
+        {   //the limit is not active on the device, so the limits are unknown
+            write_limit1 = write_limit2 = (limit.rec_settings || limit.alarm_settings);
+        }
+        else
+        {
+            write_limit1 = limit.rec_settings != cur->rec_settings || limit.alarm_settings != cur->alarm_settings ||
+                limit.limit1 != cur->limit1;
+            write_limit2 = limit.limit2 != cur->limit2;
+        }
+        if(write_limit1 || write_limit2)
+            writes.push_back([=]() { return write_limit(limit, write_limit1, write_limit2); });
+    }
+
+    if(config.start_time && !same_time(*config.start_time, current.start_time))
+    {
+        struct tm start_time = *config.start_time;
+        writes.push_back([=]() mutable {
+            uint8_t set_start_time[] = {0x8D, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00};
+            insert_time_in_command(&start_time, set_start_time);
+            return this->send_command(set_start_time, sizeof(set_start_time), nullptr, 8);
+        });
+    }
+    if(config.end_time && !same_time(*config.end_time, current.end_time))
+    {
+        struct tm end_time = *config.end_time;
+        writes.push_back([=]() mutable {
+            uint8_t set_stop_time[] = {0x8D, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00};
+            insert_time_in_command(&end_time, set_stop_time);
+            return this->send_command(set_stop_time, sizeof(set_stop_time), nullptr, 8);
+        });
+    }
+    return writes;
+}
+
+int MSR_Writer::apply(const DeviceConfig &config)
+{   //Read the settings touched by config once, and only write the ones which differ.
+    //If anything was written, those settings are read back once to verify them.
+    //Returns 0 if the device matches the config afterwards.
+    MSR_SessionGuard session(*this);
+    MSR_BaudScope fast(*this, 230400);
+    auto writes = diff_config(config, get_snapshot(config));
+    if(writes.size() == 0) return 0;
+    int returnval = 0;
+    for(auto &write : writes)
+        returnval |= write();
+    if(diff_config(config, get_snapshot(config)).size()) returnval |= 1;
+    return returnval;
+}
@@ -0,0 +1,341 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+//Benchmarks of the decoding, conversion and export done on the host.
+//The device is emulated in memory, so only the CPU side of the pipeline is measured.
+//Usage: msr145_bench [minimum seconds per benchmark]
+
+#include "msr145_tool.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <sys/resource.h> //getrusage
+
+#define BENCH_PAGE_SIZE 0x0420
+#define BENCH_RECORDINGS 4
+#define BENCH_PAGES_PER_RECORDING 32
+
+static std::atomic<uint64_t> allocations(0);
+static volatile uint64_t sink; //keeps the compiler from optimizing the benchmarked work away
+
+void *operator new(size_t size)
+{   //count all allocations, so we can report allocations per item
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size ? size : 1);
+    if(ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, __attribute__((unused)) size_t size) noexcept
+{
+    free(ptr);
+}
+
+
+class BenchDevice
+{   //The flash of an emulated device, and the answers it gives to commands.
+    //Each recording interleaves 4 channels, with a timestamp word (type 0xF) after every 64 samples,
+    //and its last page is only half full, followed by end markers.
+    public:
+        std::map<uint16_t, std::vector<uint8_t> > pages; //status byte and 0x420 bytes of data
+        uint16_t end_address;
+        size_t sample_words = 0;
+        BenchDevice();
+        std::vector<uint8_t> respond(const std::vector<uint8_t> &frame);
+    protected:
+        static uint8_t calc_chksum(const uint8_t *data, size_t length);
+};
+
+BenchDevice::BenchDevice()
+{
+    const sampletype channels[] = {pressure, T_pressure, humidity, T_humidity};
+    uint64_t time = 500000000ull << 9; //in 1/512 seconds since jan 1 2000
+    uint16_t address = 0;
+    for(int rec = 0; rec < BENCH_RECORDINGS; rec++)
+    {
+        uint16_t start_address = address;
+        size_t words = 0;
+        size_t channel = 0;
+        for(int p = 0; p < BENCH_PAGES_PER_RECORDING; p++, address++)
+        {
+            std::vector<uint8_t> page(BENCH_PAGE_SIZE + 1, 0xFF);
+            page[0] = 0x80;
+            page[1] = p == 0 ? 0x21 : 0x01;
+            page[2] = time >> 32;
+            page[3] = time & 0xFF;
+            page[4] = (time >> 8) & 0xFF;
+            page[5] = (time >> 16) & 0xFF;
+            page[6] = (time >> 24) & 0xFF;
+            page[7] = start_address & 0xFF;
+            page[8] = start_address >> 8;
+            page[9] = page[10] = 0x00;
+            size_t pos = 9 + 2;
+            if(p == 0)
+            {   //the preamble of the first page counts from 0 to 0xF
+                for(uint8_t i = 0; i < 0xF; i++, pos += 6)
+                    std::fill(page.begin() + pos, page.begin() + pos + 6, i);
+            }
+            else
+            {
+                std::fill(page.begin() + pos, page.begin() + pos + 6, 0x00);
+                pos += 6;
+            }
+            size_t end = page.size();
+            if(p == BENCH_PAGES_PER_RECORDING - 1) end = pos + (end - pos) / 8 * 4;
+            for(; pos + 4 <= end; pos += 4, words++)
+            {
+                uint8_t *word = page.data() + pos;
+                if(words % 65 == 64)
+                {   //one second given in 1/2 seconds
+                    word[0] = 0x00;
+                    word[1] = timestamp << 4;
+                    word[2] = 0x02;
+                    word[3] = 0x00;
+                    time += 1 << 9;
+                    continue;
+                }
+                uint16_t value = 2000 + (words * 37) % 500;
+                //the first channel is one second after the last sample, the rest are at the same time
+                word[0] = channel == 0 ? 0x01 : 0x00;
+                word[1] = (channels[channel] << 4) | (channel == 0 ? 0x08 : 0x00);
+                word[2] = value & 0xFF;
+                word[3] = value >> 8;
+                if(channel == 0) time += 1 << 9;
+                channel = (channel + 1) % (sizeof(channels) / sizeof(channels[0]));
+            }
+            pages[address] = page;
+        }
+        sample_words += words;
+        time += 3600 << 9;
+    }
+    end_address = address - 1;
+}
+
+uint8_t BenchDevice::calc_chksum(const uint8_t *data, size_t length)
+{   //CRC8 (dallas), same as the device
+    uint8_t crc = 0;
+    for(size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for(int k = 0; k < 8; k++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8C : crc >> 1;
+    }
+    return crc;
+}
+
+std::vector<uint8_t> BenchDevice::respond(const std::vector<uint8_t> &frame)
+{
+    std::vector<uint8_t> answer(7, 0x00);
+    answer[0] = 0x80;
+    switch(frame[0])
+    {
+        case 0x85: //baudrate changes are not answered
+            return std::vector<uint8_t>();
+        case 0x82:
+            if(frame[1] == 0x01)
+            {   //not recording, and the address of the last written page
+                answer[3] = end_address & 0xFF;
+                answer[4] = end_address >> 8;
+            }
+            break;
+        case 0x8B:
+        {
+            uint16_t address = frame[3] + (frame[4] << 8);
+            size_t length = frame[5] + (frame[6] << 8);
+            auto page = pages.find(address);
+            if(page == pages.end())
+                answer.assign(length + 1, 0xFF);
+            else
+                answer.assign(page->second.begin(), page->second.begin() + std::min(length + 1, page->second.size()));
+            answer[0] = 0x80;
+            break;
+        }
+        default:
+            break;
+    }
+    answer.push_back(calc_chksum(answer.data(), answer.size()));
+    return answer;
+}
+
+
+class BenchTransport : public MSR_MemoryTransport
+{   //As the memory transport, but without baudrate changes, so they don't add pacing delays to the results
+    public:
+        BenchTransport(responder_t _responder) : MSR_MemoryTransport(_responder) {}
+        virtual bool can_set_baud() { return false; }
+};
+
+class BenchTool : public MSRTool
+{   //Gives access to the internals we want to measure
+    public:
+        BenchTool(MSR_Transport *_transport) : MSR_Base(_transport), MSRTool(_transport) {}
+        using MSR_Base::calc_chksum;
+        using MSR_Reader::convert_to_sample;
+        using MSR_Reader::get_raw_recording;
+};
+
+
+static double min_time = 0.5;
+
+template<class F> void run_bench(const char *name, size_t items, size_t bytes, F func)
+{   //Runs func until min_time have passed, and prints the time, throughput and allocations per item
+    uint64_t allocations_before = allocations;
+    size_t iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed;
+    do
+    {
+        func();
+        iterations++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while(elapsed < min_time || iterations < 3);
+    double total_items = (double)items * iterations;
+    printf("%-28s %12.1f %12.3f %12.2f %12.3f\n", name,
+        elapsed * 1e9 / total_items,
+        total_items / elapsed / 1e6,
+        (double)bytes * iterations / elapsed / 1e6,
+        (allocations - allocations_before) / total_items);
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1) min_time = atof(argv[1]);
+    BenchDevice device;
+    BenchTool tool(new BenchTransport([&device] (const std::vector<uint8_t> &frame) { return device.respond(frame); }));
+
+    auto records = tool.get_rec_list();
+    std::vector<std::vector<raw_page> > raw_records;
+    std::vector<std::vector<sample> > sample_records;
+    size_t sample_count = 0;
+    for(auto &record : records)
+    {
+        raw_records.push_back(tool.get_raw_recording(record));
+        sample_records.push_back(tool.get_samples(record));
+        sample_count += sample_records.back().size();
+    }
+    size_t page_count = device.pages.size();
+    printf("Fixture: %zu recordings, %zu pages, %zu sample words, %zu samples\n\n",
+        records.size(), page_count, device.sample_words, sample_count);
+    printf("%-28s %12s %12s %12s %12s\n", "Benchmark", "ns/item", "Mitems/s", "MB/s", "allocs/item");
+
+    auto &page = device.pages.begin()->second;
+    run_bench("calc_chksum (bytes)", page.size(), page.size(), [&] ()
+    {
+        sink += tool.calc_chksum(page.data(), page.size());
+    });
+
+    size_t raw_bytes = 0;
+    for(auto &raw_record : raw_records)
+        for(auto &raw_page : raw_record)
+            raw_bytes += raw_page.data.size();
+    run_bench("convert_to_sample (words)", raw_bytes / 4, raw_bytes, [&] ()
+    {
+        for(auto &raw_record : raw_records)
+            for(auto &raw_page : raw_record)
+            {
+                uint64_t timestamp = 0;
+                for(size_t i = 0; i < raw_page.data.size(); i += 4)
+                    sink += tool.convert_to_sample(raw_page.data.data() + i, &timestamp).value;
+            }
+    });
+
+    run_bench("get_samples (samples)", sample_count, page_count * (BENCH_PAGE_SIZE + 2), [&] ()
+    {
+        for(auto &record : records)
+            sink += tool.get_samples(record).size();
+    });
+
+    run_bench("get_rec_list (records)", records.size(), 0, [&] ()
+    {
+        sink += tool.get_rec_list().size();
+    });
+
+    run_bench("convert_to_unit (samples)", sample_count, 0, [&] ()
+    {
+        float sum = 0;
+        for(auto &samples : sample_records)
+            for(auto &cur_sample : samples)
+                sum += tool.convert_to_unit(cur_sample.type, cur_sample.value);
+        sink += sum;
+    });
+
+    //the values of each channel of each recording as one column, as create_csv converts them
+    std::vector<std::pair<unit_conversion, std::vector<int16_t> > > value_columns;
+    for(auto &samples : sample_records)
+        for(auto type : {sampletype::pressure, sampletype::T_pressure, sampletype::humidity, sampletype::T_humidity})
+        {
+            value_columns.push_back(std::make_pair(msr_unit_conversion(type), std::vector<int16_t>()));
+            for(auto &cur_sample : samples)
+                if(cur_sample.type == type) value_columns.back().second.push_back(cur_sample.value);
+        }
+    size_t column_values = 0;
+    for(auto &value_column : value_columns)
+        column_values += value_column.second.size();
+    std::vector<float> converted(column_values);
+    run_bench("convert_column (samples)", column_values, 0, [&] ()
+    {
+        float sum = 0;
+        for(auto &value_column : value_columns)
+        {
+            msr_convert_column(value_column.first, value_column.second.data(), value_column.second.size(), converted.data());
+            sum += converted[0];
+        }
+        sink += sum;
+    });
+
+    //a limit on every channel, and a rate of change on the first, which hardly ever fire on the fixture
+    std::vector<msr_rule> rules;
+    for(auto type : {sampletype::pressure, sampletype::T_pressure, sampletype::humidity, sampletype::T_humidity})
+    {
+        msr_rule rule;
+        rule.type = type;
+        rule.mode = alarm_less_limit1_or_more_limit2;
+        rule.limit1 = INT16_MIN + 1;
+        rule.limit2 = INT16_MAX - 1;
+        rule.min_duration = MSR_TICKS_PER_SECOND;
+        rules.push_back(rule);
+    }
+    rules.push_back(msr_rule());
+    rules.back().type = sampletype::pressure;
+    rules.back().kind = rule_kind::rate_of_change;
+    rules.back().max_rate = 1000000;
+    MSR_RuleEngine engine(rules, [] (const rule_event &event) { sink += event.value; });
+    run_bench("rules (samples)", sample_count, 0, [&] ()
+    {
+        for(auto &samples : sample_records)
+        {
+            engine.reset();
+            engine.evaluate(samples);
+        }
+        sink += engine.get_events();
+    });
+
+    std::string seperator = ",";
+    size_t csv_bytes = 0;
+    for(auto &samples : sample_records)
+        csv_bytes += tool.create_csv(samples, seperator).size();
+    run_bench("create_csv (samples)", sample_count, csv_bytes, [&] ()
+    {
+        for(auto &samples : sample_records)
+            sink += tool.create_csv(samples, seperator).size();
+    });
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("\nPeak memory: %ld kB\n", usage.ru_maxrss);
+    return 0;
+}
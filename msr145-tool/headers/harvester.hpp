@@ -0,0 +1,50 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+#include "msr145_tool.hpp"
+#include <atomic>
+#include <string>
+#include <vector>
+
+struct harvest_result
+{
+    std::string port;
+    std::string serial;
+    bool ok = false;
+    std::string error;
+    size_t recordings = 0;
+    size_t samples = 0;
+    double seconds = 0;
+    uint64_t bytes_in = 0;
+    uint64_t retries = 0;
+    uint64_t timeouts = 0;
+};
+
+class Harvester
+{   //Extracts all recordings from many devices at once, with one worker thread per port, up to max_workers.
+    //The recordings are written to <outdir>/<serial>_<record number>.csv
+    protected:
+        std::vector<std::string> ports;
+        size_t max_workers;
+        std::string outdir;
+        std::string seperator;
+        std::vector<harvest_result> results;
+        std::atomic<size_t> next_port;
+        double wall_time = 0;
+        virtual void work();
+        virtual void harvest_device(harvest_result &result);
+    public:
+        Harvester(std::vector<std::string> _ports, size_t _max_workers, std::string _outdir, std::string _seperator) :
+            ports(_ports), max_workers(_max_workers), outdir(_outdir), seperator(_seperator), next_port(0) {}
+        virtual ~Harvester() {}
+        virtual void run();
+        virtual const std::vector<harvest_result> &get_results() { return results; }
+        virtual std::string get_report();
+};
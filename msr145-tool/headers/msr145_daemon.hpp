@@ -0,0 +1,120 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#pragma once
+#include "msr145_tool.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+#define MSR145D_DEFAULT_SOCKET "/tmp/msr145d.sock"
+
+//Requests are one line of tab separated fields, the first being the command and the second the device
+//(port or serial number). The answer is the output of the command, followed by a line with
+//MSR145D_TRAILER "OK" or MSR145D_TRAILER "ERROR <message>".
+//    devices
+//    status <device>
+//    sensors <device> <sampletype number>...
+//    list <device>
+//    extract <device> <record number> <seperator>
+#define MSR145D_TRAILER "#msr145d "
+
+struct daemon_device
+{   //A device kept open by the daemon, and what we know about it
+    std::string port;
+    std::string serial;
+    std::unique_ptr<MSRTool> msr;
+    std::unique_ptr<MSR_ShmPublisher> publisher; //of the sensor values, if the daemon was asked to
+    std::mutex mutex; //for everything below
+    std::string error; //of the last keepalive, empty if it went well
+    bool recording = false;
+    uint16_t end_address = 0;
+    bool have_rec_list = false;
+    std::vector<rec_entry> rec_list;
+    std::string status_str;
+    std::chrono::steady_clock::time_point status_time;
+    std::map<int, std::pair<int16_t, std::chrono::steady_clock::time_point> > values; //by sampletype
+    bool have_L1 = false;
+    std::string L1_unit;
+    float L1_offset = 0, L1_gain = 0;
+    //CSV of completed recordings, by address and seperator
+    std::map<std::pair<uint16_t, std::string>, std::pair<rec_entry, std::string> > extracted;
+};
+
+class MSRDaemon
+{   //Keeps devices open at a high baudrate, and serves the requests of clients on a UNIX socket.
+    //A keepalive reads the status of each device every keepalive_interval, so the device stays at the baudrate,
+    //and the cached recording list is thrown away when the recording state changes.
+    //Each client is served in a thread of its own, up to max_clients at a time. The client must send its request
+    //within request_timeout and read the answer within answer_timeout, so a stuck client can't keep stop from returning.
+    //Repeated requests are served from the cache: the status for status_ttl, sensor values for value_ttl,
+    //and the CSV of completed recordings for as long as the recording list stays the same.
+    //With a publish_interval the sensors in publish_types are read at that rate, and written to the shared memory
+    //segment of the device (see MSR_ShmPublisher). All devices are read by one DeviceReactor in a thread of its own,
+    //except those whose port it can't wait on, which get a thread each. Sensor values read for clients are published too.
+    //serve_metrics answers GET /metrics with the cached sensor values and the metrics of the links in the
+    //Prometheus text format. A scrape never talks to the devices.
+    protected:
+        std::string socket_path;
+        uint32_t baud;
+        std::chrono::milliseconds keepalive_interval;
+        std::chrono::milliseconds status_ttl;
+        std::chrono::milliseconds value_ttl;
+        std::vector<std::unique_ptr<daemon_device> > devices;
+        boost::asio::io_service ioservice;
+        boost::asio::local::stream_protocol::acceptor acceptor;
+        std::atomic<bool> stopping;
+        std::mutex client_mutex;
+        std::condition_variable client_done;
+        size_t active_clients = 0;
+        size_t max_clients = 16; //more are turned away, so a flood of clients can't start unlimited threads
+        std::chrono::seconds request_timeout = std::chrono::seconds(10); //to send the request line
+        std::chrono::seconds answer_timeout = std::chrono::seconds(60); //to read the answer
+        std::thread keepalive_thread;
+        boost::asio::ip::tcp::acceptor metrics_acceptor;
+        std::thread metrics_thread;
+        std::unique_ptr<DeviceReactor> reactor; //reads the published sensors
+        std::vector<daemon_device *> reactor_devices; //by id in the reactor
+        std::thread reactor_thread;
+        virtual void keepalive();
+        virtual void refresh_state(daemon_device &device);
+        virtual void serve_client(std::shared_ptr<boost::asio::local::stream_protocol::iostream> stream);
+        virtual void handle_request(const std::vector<std::string> &fields, std::ostream &out_stream);
+        virtual daemon_device &find_device(const std::string &name);
+        virtual std::vector<rec_entry> get_rec_list(daemon_device &device);
+        virtual void print_sensors(daemon_device &device, const std::vector<sampletype> &types, std::ostream &out_stream);
+        virtual void extract(daemon_device &device, uint32_t rec_num, std::string seperator, std::ostream &out_stream);
+        virtual void metrics_loop();
+        virtual std::string get_prometheus();
+    public:
+        MSRDaemon(std::vector<std::string> ports, std::string _socket_path, uint32_t _baud = 230400,
+            std::chrono::milliseconds _keepalive_interval = std::chrono::milliseconds(2000),
+            std::chrono::milliseconds _status_ttl = std::chrono::milliseconds(10000),
+            std::chrono::milliseconds _value_ttl = std::chrono::milliseconds(1000));
+        //Must be called before run. An interval of 0 publishes only the values read for clients.
+        virtual void publish(const std::vector<sampletype> &publish_types, std::chrono::microseconds publish_interval);
+        //Must be called before run. Listens for HTTP scrapes in a thread of its own.
+        virtual void serve_metrics(uint16_t port, const std::string &address = "127.0.0.1");
+        virtual ~MSRDaemon();
+        virtual void run(); //serves clients until stop is called
+        virtual void stop();
+        virtual size_t get_device_count() { return devices.size(); }
+};
+
+//Sends one request to the daemon, and writes the answer to out_stream as it arrives.
+//Returns 0 if the daemon answered OK, else the error is written to std::cerr and 1 is returned.
+int msr145d_request(const std::string &socket_path, const std::vector<std::string> &fields, std::ostream &out_stream);
@@ -11,8 +11,18 @@
 #include "libmsr145.hpp"
 #include <string>
 #include <ostream>
+#include <iostream>
+#define MSR_CSV_REORDER_LINES 64 //lines create_csv_lines keeps open for samples which come out of time order
 typedef std::pair<float, std::vector<active_measurement::active_measurement> > measure_interval_pair;
 
+struct csv_columns
+{   //The layout of an extracted CSV file
+    std::vector<sampletype> types;
+    float L1_gain = 0;
+    float L1_offset = 0;
+    double first_time = 0; //timestamps are written relative to this
+};
+
 
 class MSRTool : public MSRDevice
 {
@@ -21,29 +31,40 @@ class MSRTool : public MSRDevice
     public:
         MSRTool(std::string _portname) : MSR_Base(_portname), MSRDevice(_portname)
             {}
+        MSRTool(MSR_Transport *_transport) : MSR_Base(_transport), MSRDevice(_transport)
+            {}
         virtual ~MSRTool()
             {}
-        virtual void print_status();
+        virtual void print_status(std::ostream &out_stream = std::cout);
         virtual void set_lightsensor() { light_sensor = true; }
         using MSR_Writer::start_recording;
         virtual void start_recording(std::string starttime_str, std::string stoptime_str, bool ringbuff);
         virtual void start_recording(startcondition start_option, bool ringbuff); //only to use for push options
         virtual std::string get_time_str(struct tm(MSRTool::*get_func)(void));
+        virtual std::string get_time_str(struct tm time_s);
         virtual std::string get_device_time_str();
         virtual std::string get_start_time_str();
         virtual std::string get_end_time_str();
-        virtual std::string get_interval_string();
+        virtual std::string get_interval_string(const DeviceSnapshot &snapshot);
         virtual float convert_to_unit(sampletype type, int16_t value, float conversion_factor = 0);
         virtual std::string get_sensor_str(sampletype type, int16_t value);
-        virtual std::string get_start_settings_str();
-        virtual std::string get_sample_limit_str(sampletype type);
-        virtual std::string get_limits_str();
-        virtual std::string get_calibration_str();
-        std::string get_calibration_type_str(active_calibrations::active_calibrations type);
+        virtual std::string get_sensor_str(sampletype type, int16_t value, const std::string &L1_unit, float L1_offset, float L1_gain);
+        virtual std::string get_start_settings_str(const DeviceSnapshot &snapshot);
+        virtual std::string get_sample_limit_str(const limit_entry &limit);
+        virtual std::string get_limits_str(const DeviceSnapshot &snapshot);
+        virtual std::string get_calibration_str(const DeviceSnapshot &snapshot);
+        std::string get_calibration_type_str(active_calibrations::active_calibrations type, const DeviceSnapshot &snapshot);
         virtual void get_type_str(sampletype type, std::string &type_str, std::string &unit_str);
-        virtual void list_recordings();
+        virtual void list_recordings(std::ostream &out_stream = std::cout);
+        virtual std::string get_recordings_str(const std::vector<rec_entry> &rec_list);
         virtual void extract_record(uint32_t rec_num, std::string seperator, std::ostream &out_stream);
+        virtual size_t extract_record(const rec_entry &record, std::string seperator, std::ostream &out_stream); //returns the number of samples
+        //Extracts the samples of record, and while it is active, appends the new samples every interval seconds
+        virtual size_t follow_record(const rec_entry &record, std::string seperator, std::ostream &out_stream, float interval);
         virtual std::string create_csv(std::vector<sample> &samples, std::string &seperator);
+        virtual csv_columns get_csv_columns(const std::vector<sample> &samples);
+        virtual std::string create_csv_header(const csv_columns &columns, std::string &seperator);
+        virtual std::string create_csv_lines(const std::vector<sample> &samples, const csv_columns &columns, std::string &seperator);
         virtual void set_measurement_and_timers(std::vector<measure_interval_pair> interval_typelist);
         virtual void set_name(std::string name);
         virtual void set_calibration_date(uint16_t year, uint16_t month, uint16_t day);
@@ -51,10 +72,14 @@ class MSRTool : public MSRDevice
         virtual int16_t convert_from_unit(sampletype type, int16_t value, float conversion_factor = 0);
         virtual void set_calibrationpoints(active_calibrations::active_calibrations type, std::vector<float> points);
         virtual std::string get_firmware_version_str();
+        virtual std::string get_firmware_version_str(int major, int minor);
         using MSRDevice::set_time;
         virtual void set_time(std::string timestr);
         virtual void set_limit(sampletype type, float limit1, float limit2, limit_setting record_limit, limit_setting alarm_limit);
-        virtual void print_sensors(std::vector<sampletype> sensor_to_poll);
+        virtual void print_sensors(std::vector<sampletype> sensor_to_poll, std::ostream &out_stream = std::cout);
+        virtual void stream_sensors(std::vector<sampletype> sensor_to_poll, float rate, float duration,
+            std::string seperator, std::ostream &out_stream);
+        virtual void bench_link(bool csv);
         using MSRDevice::set_limit;
     private:
 };
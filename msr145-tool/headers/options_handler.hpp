@@ -5,7 +5,10 @@
 #include <thread>
 #include <chrono>
 #include <fstream>
-#include "msr145_tool.hpp"
+#include <iomanip>
+#include <cstdlib>
+#include "harvester.hpp"
+#include "msr145_daemon.hpp"
 
 #define COMMAND_LINE_ERROR 1
 #define UNHANDLED_EXCEPTION 2
@@ -19,10 +22,16 @@ class options_handler
         void handle_sampling_args(po::variables_map &vm, MSRTool &msr);
         int handle_extract_args(__attribute__((unused))po::variables_map &vm, MSRTool &msr);
         int handle_start_args(po::variables_map &vm, MSRTool &msr);
+        int handle_harvest_args(po::variables_map &vm);
+        int handle_client_args(po::variables_map &vm);
+        int handle_discover_args(po::variables_map &vm);
+        std::string get_port_cache(po::variables_map &vm);
         int add_to_intervallist(std::vector<float> &interval_list, active_measurement::active_measurement type,
             std::vector<measure_interval_pair> &interval_type_list);
         limit_setting parse_alarm_limit(std::string limit_str);
         void handle_get_sensors(po::variables_map &vm, MSRTool &msr);
+        std::vector<sampletype> parse_sensor_types(po::variables_map &vm);
+        int handle_stream_args(po::variables_map &vm, MSRTool &msr);
         limit_setting parse_recording_limit(std::string limit_str);
         bool measure_interval_pair_cmp(measure_interval_pair &p1, measure_interval_pair &p2);
         int handle_command(po::variables_map &vm, MSRTool *&msr);
@@ -0,0 +1,105 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "harvester.hpp"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+void Harvester::run()
+{
+    results.assign(ports.size(), harvest_result());
+    next_port = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for(size_t i = 0; i < std::min(max_workers, ports.size()); i++)
+        workers.emplace_back(&Harvester::work, this);
+    for(auto &worker : workers)
+        worker.join();
+    wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Harvester::work()
+{   //take ports until there are no more. Each result is only touched by the worker taking its port.
+    for(size_t i = next_port++; i < ports.size(); i = next_port++)
+    {
+        results[i].port = ports[i];
+        auto start = std::chrono::steady_clock::now();
+        try
+        {
+            harvest_device(results[i]);
+            results[i].ok = true;
+        }
+        catch(std::exception &e)
+        {
+            results[i].error = e.what();
+        }
+        results[i].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+void Harvester::harvest_device(harvest_result &result)
+{
+    MSRTool msr(result.port);
+    auto &metrics = msr.get_metrics();
+    auto save_metrics = [&result, &metrics] ()
+    {
+        result.bytes_in = metrics.bytes_in;
+        result.retries = metrics.retries;
+        result.timeouts = metrics.timeouts;
+    };
+    try
+    {
+        result.serial = msr.get_serial();
+        auto rec_list = msr.get_rec_list();
+        for(size_t i = 0; i < rec_list.size(); i++)
+        {
+            std::string filename = outdir + "/" + result.serial + "_" + std::to_string(i) + ".csv";
+            std::ofstream out_stream(filename);
+            if(!out_stream.is_open())
+                throw std::runtime_error("Could not open " + filename);
+            result.samples += msr.extract_record(rec_list[i], seperator, out_stream);
+            result.recordings++;
+        }
+    }
+    catch(std::exception &)
+    {   //keep the retries and timeouts of failed devices in the report
+        save_metrics();
+        throw;
+    }
+    save_metrics();
+}
+
+std::string Harvester::get_report()
+{
+    std::stringstream ret_str;
+    size_t failed = 0, samples = 0;
+    uint64_t bytes_in = 0, retries = 0, timeouts = 0;
+    ret_str << std::fixed << std::setprecision(1);
+    ret_str << "Harvest report:" << std::endl;
+    ret_str << "Port\t\tSerial\tRecords\tSamples\tTime (s)\tBytes/s\tRetries\tTimeouts\tResult" << std::endl;
+    for(auto &result : results)
+    {
+        ret_str << result.port << "\t" << result.serial << "\t" << result.recordings << "\t" << result.samples << "\t"
+            << result.seconds << "\t\t" << (result.seconds > 0 ? result.bytes_in / result.seconds : 0) << "\t"
+            << result.retries << "\t" << result.timeouts << "\t\t" << (result.ok ? "OK" : "FAILED: " + result.error) << std::endl;
+        if(!result.ok) failed++;
+        samples += result.samples;
+        bytes_in += result.bytes_in;
+        retries += result.retries;
+        timeouts += result.timeouts;
+    }
+    ret_str << std::endl << "Devices: " << results.size() << ", failed: " << failed << ", samples: " << samples
+        << ", retries: " << retries << ", timeouts: " << timeouts << std::endl;
+    ret_str << "Wall clock time: " << wall_time << " s, throughput: " << (wall_time > 0 ? bytes_in / wall_time : 0)
+        << " bytes/s" << std::endl;
+    return ret_str.str();
+}
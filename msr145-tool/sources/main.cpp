@@ -1,12 +1,14 @@
 #include "options_handler.hpp"
 int main(int argc, char const **argv) {
     options_handler o_handler(true);
+    int returnval = 0;
     try
     {
         MSRTool *msr = nullptr;
         try
         {
-            o_handler.handle_args(argc, argv, msr);
+            returnval = o_handler.handle_args(argc, argv, msr);
+            delete msr; //resets the baudrate and closes any capture
         }
         catch(po::error &e)
         {
@@ -21,5 +23,5 @@ int main(int argc, char const **argv) {
         << "\nBailing out!" << std::endl;
         return UNHANDLED_EXCEPTION;
     }
-    return 0;
+    return returnval;
 }
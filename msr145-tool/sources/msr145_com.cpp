@@ -60,6 +60,7 @@ int main(__attribute__((unused))int argc, __attribute__((unused)) char const *ar
                 return COMMAND_LINE_ERROR;
             }
         }
+        delete msr;
     }
     catch(std::exception &e)
     {
@@ -0,0 +1,525 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+#include "msr145_daemon.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h> //shutdown
+#include <unistd.h> //unlink
+using boost::asio::local::stream_protocol;
+using boost::asio::ip::tcp;
+
+static bool same_record(const rec_entry &rec1, const rec_entry &rec2)
+{
+    return rec1.address == rec2.address && rec1.length == rec2.length && rec1.isRecording == rec2.isRecording &&
+        rec1.time.tm_year == rec2.time.tm_year && rec1.time.tm_yday == rec2.time.tm_yday &&
+        rec1.time.tm_hour == rec2.time.tm_hour && rec1.time.tm_min == rec2.time.tm_min && rec1.time.tm_sec == rec2.time.tm_sec;
+}
+
+MSRDaemon::MSRDaemon(std::vector<std::string> ports, std::string _socket_path, uint32_t _baud,
+    std::chrono::milliseconds _keepalive_interval, std::chrono::milliseconds _status_ttl, std::chrono::milliseconds _value_ttl) :
+    socket_path(_socket_path), baud(_baud), keepalive_interval(_keepalive_interval), status_ttl(_status_ttl),
+    value_ttl(_value_ttl), acceptor(ioservice), stopping(false), metrics_acceptor(ioservice)
+{
+    for(auto &port : ports)
+    {
+        std::unique_ptr<daemon_device> device(new daemon_device());
+        device->port = port;
+        try
+        {
+            device->msr.reset(new MSRTool(port));
+            device->serial = device->msr->get_serial();
+            device->msr->set_session_baud(baud);
+        }
+        catch(std::exception &e)
+        {   //serve the devices which work
+            std::cerr << "Could not open " << port << ": " << e.what() << std::endl;
+            continue;
+        }
+        refresh_state(*device);
+        devices.push_back(std::move(device));
+    }
+    if(devices.empty())
+        throw std::runtime_error("None of the devices could be opened");
+    ::unlink(socket_path.c_str()); //left by an earlier daemon which didn't exit cleanly
+    acceptor.open(stream_protocol());
+    acceptor.bind(stream_protocol::endpoint(socket_path));
+    acceptor.listen();
+    keepalive_thread = std::thread(&MSRDaemon::keepalive, this);
+}
+
+MSRDaemon::~MSRDaemon()
+{
+    stop();
+    keepalive_thread.join();
+    if(metrics_thread.joinable()) metrics_thread.join();
+    if(reactor_thread.joinable()) reactor_thread.join();
+    for(auto &device : devices)
+        device->publisher.reset(); //removes the segment
+
+    acceptor.close();
+    ::unlink(socket_path.c_str());
+    //the devices are set back to 9600 when they are deleted
+}
+
+void MSRDaemon::publish(const std::vector<sampletype> &publish_types, std::chrono::microseconds publish_interval)
+{
+    std::vector<std::string> names;
+    if(publish_interval.count() > 0 && publish_types.size())
+        reactor.reset(new DeviceReactor(command_priority::live));
+    for(auto &device : devices)
+    {   //devices with the same serial number would share the segment
+        std::string name = MSR_SHM_PREFIX + device->serial;
+        for(int i = 2; std::find(names.begin(), names.end(), name) != names.end(); i++)
+            name = MSR_SHM_PREFIX + device->serial + "-" + std::to_string(i);
+        names.push_back(name);
+        //the publisher only reads the sensors itself if the reactor can't
+        bool in_reactor = reactor && device->msr->get_fd() >= 0;
+        device->publisher.reset(new MSR_ShmPublisher(*device->msr, publish_types,
+            in_reactor ? std::chrono::microseconds(0) : publish_interval, name));
+        device->publisher->start();
+        if(in_reactor)
+        {
+            reactor->add_device(*device->msr, publish_types, publish_interval);
+            reactor_devices.push_back(device.get());
+        }
+        std::cerr << "Publishing " << device->port << " in " << device->publisher->get_name() << std::endl;
+    }
+    if(reactor_devices.empty())
+    {
+        reactor.reset();
+        return;
+    }
+    reactor->on_sensor_data([this, publish_types] (size_t id, const std::vector<int16_t> &values)
+        { reactor_devices[id]->publisher->publish(publish_types.data(), values.size(), values.data()); });
+    //the old values stay, their timestamps tell the readers how old they are
+    reactor->on_error([this] (size_t id, __attribute__((unused)) const std::string &error)
+        { reactor_devices[id]->publisher->count_error(); });
+    reactor_thread = std::thread([this] ()
+    {
+        try
+        {
+            reactor->run();
+        }
+        catch(std::exception &e)
+        {
+            std::cerr << "Publishing stopped: " << e.what() << std::endl;
+        }
+    });
+}
+
+void MSRDaemon::serve_metrics(uint16_t port, const std::string &address)
+{
+    tcp::endpoint endpoint(boost::asio::ip::make_address(address), port);
+    metrics_acceptor.open(endpoint.protocol());
+    metrics_acceptor.set_option(tcp::acceptor::reuse_address(true));
+    metrics_acceptor.bind(endpoint);
+    metrics_acceptor.listen();
+    metrics_thread = std::thread(&MSRDaemon::metrics_loop, this);
+}
+
+void MSRDaemon::metrics_loop()
+{   //Scrapes are cheap, so they are answered one at a time
+    while(!stopping)
+    {
+        tcp::iostream stream;
+        boost::system::error_code error;
+        metrics_acceptor.accept(stream.socket(), error);
+        if(error) continue;
+        stream.expires_after(std::chrono::seconds(5)); //so a client which doesn't send anything can't block the scrapes
+        std::string method, path, line;
+        stream >> method >> path;
+        while(std::getline(stream, line) && line != "\r" && line.size()); //the rest of the request line, and the headers
+        std::string body, status = "200 OK";
+        if(method != "GET")
+            status = "405 Method Not Allowed";
+        else if(path == "/metrics" || path == "/")
+            body = get_prometheus();
+        else
+            status = "404 Not Found";
+        stream << "HTTP/1.0 " << status << "\r\n"
+            << "Content-Type: text/plain; version=0.0.4\r\n"
+            << "Content-Length: " << body.size() << "\r\n"
+            << "Connection: close\r\n\r\n" << body << std::flush;
+    }
+}
+
+std::string MSRDaemon::get_prometheus()
+{
+    static const std::pair<sampletype, const char *> channels[] =
+    {
+        {sampletype::pressure, "pressure"}, {sampletype::T_pressure, "temp_pressure"},
+        {sampletype::humidity, "humidity"}, {sampletype::T_humidity, "temp_humidity"},
+        {sampletype::bat, "battery"}, {sampletype::light, "light"},
+        {sampletype::ext1, "ext1"}, {sampletype::ext2, "ext2"}, {sampletype::ext3, "ext3"}, {sampletype::ext4, "ext4"},
+    };
+    std::stringstream up, recording, bauds, values, ages;
+    std::vector<std::pair<std::string, MSR_Metrics *> > links;
+    auto steady_now = std::chrono::steady_clock::now();
+    auto system_now = std::chrono::system_clock::now();
+    values << std::setprecision(10);
+    for(auto &device : devices)
+    {
+        std::string labels = "serial=\"" + device->serial + "\",port=\"" + device->port + "\"";
+        links.push_back(std::make_pair(labels, &device->msr->get_metrics()));
+        std::lock_guard<std::mutex> guard(device->mutex);
+        up << "msr145_up{" << labels << "} " << device->error.empty() << "\n";
+        recording << "msr145_recording{" << labels << "} " << device->recording << "\n";
+        bauds << "msr145_baud{" << labels << "} " << device->msr->get_baud() << "\n";
+        for(auto &channel : channels)
+        {   //the newest of the value read for a client and the one published
+            int16_t value = 0;
+            double age = -1;
+            auto cached = device->values.find(channel.first);
+            if(cached != device->values.end())
+            {
+                value = cached->second.first;
+                age = std::chrono::duration<double>(steady_now - cached->second.second).count();
+            }
+            shm_reading reading;
+            if(device->publisher && device->publisher->get_latest(channel.first, reading))
+            {
+                double published_age = std::chrono::duration<double>(system_now - reading.time).count();
+                if(age < 0 || published_age < age)
+                {
+                    value = reading.value;
+                    age = published_age;
+                }
+            }
+            if(age < 0) continue;
+            std::string type_str, unit_str;
+            device->msr->get_type_str(channel.first, type_str, unit_str);
+            unit_conversion conversion = msr_unit_conversion(channel.first);
+            if(channel.first == sampletype::light)
+            {
+                if(!device->have_L1) continue;
+                unit_str = device->L1_unit;
+                unit_str.erase(unit_str.find_last_not_of(std::string(" \0", 2)) + 1); //padded on the device
+                conversion = msr_unit_conversion(channel.first, device->L1_gain, device->L1_offset);
+            }
+            float converted = msr_convert_value(conversion, value);
+            std::string channel_labels = labels + ",channel=\"" + channel.second + "\",unit=\"" + unit_str + "\"";
+            values << "msr145_sensor_value{" << channel_labels << "} " << converted << "\n";
+            ages << "msr145_sensor_age_seconds{" << channel_labels << "} " << std::max(age, 0.) << "\n";
+        }
+    }
+    std::stringstream ret_str;
+    ret_str << "# HELP msr145_up 1 if the last keepalive of the device was answered\n"
+        "# TYPE msr145_up gauge\n" << up.str();
+    ret_str << "# HELP msr145_recording 1 if the device is recording\n"
+        "# TYPE msr145_recording gauge\n" << recording.str();
+    ret_str << "# HELP msr145_baud Baudrate of the link to the device\n"
+        "# TYPE msr145_baud gauge\n" << bauds.str();
+    ret_str << "# HELP msr145_sensor_value Latest sensor value, in the unit given by the unit label\n"
+        "# TYPE msr145_sensor_value gauge\n" << values.str();
+    ret_str << "# HELP msr145_sensor_age_seconds Time since the sensor value was read\n"
+        "# TYPE msr145_sensor_age_seconds gauge\n" << ages.str();
+    ret_str << MSR_Metrics::prometheus(links);
+    return ret_str.str();
+}
+
+void MSRDaemon::run()
+{
+    while(!stopping)
+    {
+        auto stream = std::make_shared<stream_protocol::iostream>();
+        boost::system::error_code error;
+        acceptor.accept(stream->socket(), error);
+        if(error) continue;
+        {
+            std::lock_guard<std::mutex> guard(client_mutex);
+            if(active_clients >= max_clients)
+            {   //the request isn't read, so this can't block
+                stream->expires_after(std::chrono::seconds(1));
+                *stream << MSR145D_TRAILER "ERROR msr145d is serving too many clients" << std::endl;
+                continue;
+            }
+            active_clients++;
+        }
+        std::thread(&MSRDaemon::serve_client, this, stream).detach();
+    }
+    //the devices must stay open until the clients are done with them
+    std::unique_lock<std::mutex> lock(client_mutex);
+    client_done.wait(lock, [this] () { return active_clients == 0; });
+}
+
+void MSRDaemon::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(client_mutex);
+        if(stopping) return;
+        stopping = true;
+    }
+    client_done.notify_all();
+    if(reactor) reactor->stop();
+    ::shutdown(acceptor.native_handle(), SHUT_RDWR); //makes a waiting accept return
+    if(metrics_acceptor.is_open())
+        ::shutdown(metrics_acceptor.native_handle(), SHUT_RDWR);
+}
+
+void MSRDaemon::keepalive()
+{
+    std::unique_lock<std::mutex> lock(client_mutex);
+    while(!client_done.wait_for(lock, keepalive_interval, [this] () { return stopping.load(); }))
+    {
+        lock.unlock();
+        for(auto &device : devices)
+            refresh_state(*device);
+        lock.lock();
+    }
+}
+
+void MSRDaemon::refresh_state(daemon_device &device)
+{   //Reads the status, which keeps the device from falling back to 9600
+    MSR_PriorityScope priority(command_priority::bulk);
+    try
+    {
+        if(device.msr->get_baud() != baud)
+            device.msr->set_session_baud(baud); //a command failed, and the device was taken back to 9600
+        uint8_t get_status[] = {0x82, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00};
+        uint8_t status[8];
+        device.msr->send_command(get_status, sizeof(get_status), status, sizeof(status));
+        bool recording = status[1] & 0x03;
+        uint16_t end_address = (status[4] << 8) + status[3];
+        std::lock_guard<std::mutex> guard(device.mutex);
+        if(recording != device.recording || end_address != device.end_address)
+            device.have_rec_list = false;
+        device.recording = recording;
+        device.end_address = end_address;
+        device.error.clear();
+    }
+    catch(std::exception &e)
+    {
+        std::lock_guard<std::mutex> guard(device.mutex);
+        device.error = e.what();
+    }
+}
+
+void MSRDaemon::serve_client(std::shared_ptr<stream_protocol::iostream> stream)
+{
+    std::string line;
+    stream->expires_after(request_timeout);
+    if(std::getline(*stream, line))
+    {
+        std::vector<std::string> fields;
+        std::stringstream line_stream(line);
+        std::string field;
+        while(std::getline(line_stream, field, '\t'))
+            fields.push_back(field);
+        //the answer is made before it is send, so the time the devices take doesn't count against the client.
+        //It gets a newline before the trailer, which the client removes again.
+        std::stringstream answer;
+        try
+        {
+            handle_request(fields, answer);
+            answer << "\n" MSR145D_TRAILER "OK" << std::endl;
+        }
+        catch(std::exception &e)
+        {
+            answer << "\n" MSR145D_TRAILER "ERROR " << e.what() << std::endl;
+        }
+        stream->expires_after(answer_timeout);
+        *stream << answer.rdbuf() << std::flush;
+    }
+    stream->close();
+    {
+        std::lock_guard<std::mutex> guard(client_mutex);
+        active_clients--;
+    }
+    client_done.notify_all();
+}
+
+daemon_device &MSRDaemon::find_device(const std::string &name)
+{
+    for(auto &device : devices)
+        if(device->port == name || device->serial == name)
+            return *device;
+    throw std::runtime_error("The daemon has no device " + name);
+}
+
+void MSRDaemon::handle_request(const std::vector<std::string> &fields, std::ostream &out_stream)
+{
+    if(fields.empty())
+        throw std::runtime_error("Empty request");
+    const std::string &command = fields[0];
+    if(command == "devices")
+    {
+        for(auto &device : devices)
+        {
+            std::lock_guard<std::mutex> guard(device->mutex);
+            out_stream << device->port << "\t" << device->serial << "\t" << (device->recording ? "recording" : "idle");
+            if(device->error.size()) out_stream << "\t" << device->error;
+            out_stream << "\n";
+        }
+        return;
+    }
+    if(fields.size() < 2)
+        throw std::runtime_error("No device given");
+    daemon_device &device = find_device(fields[1]);
+    if(command == "status")
+    {
+        std::string status_str;
+        {
+            std::lock_guard<std::mutex> guard(device.mutex);
+            if(std::chrono::steady_clock::now() - device.status_time < status_ttl)
+                status_str = device.status_str;
+        }
+        if(status_str.empty())
+        {
+            std::stringstream status_stream;
+            device.msr->print_status(status_stream);
+            status_str = status_stream.str();
+            std::lock_guard<std::mutex> guard(device.mutex);
+            device.status_str = status_str;
+            device.status_time = std::chrono::steady_clock::now();
+        }
+        out_stream << status_str;
+    }
+    else if(command == "sensors")
+    {
+        std::vector<sampletype> types;
+        for(size_t i = 2; i < fields.size(); i++)
+            types.push_back((sampletype)std::stoi(fields[i]));
+        print_sensors(device, types, out_stream);
+    }
+    else if(command == "list")
+    {
+        out_stream << device.msr->get_recordings_str(get_rec_list(device));
+    }
+    else if(command == "extract")
+    {
+        if(fields.size() < 3)
+            throw std::runtime_error("No record number given");
+        extract(device, std::stoul(fields[2]), fields.size() > 3 ? fields[3] : ",", out_stream);
+    }
+    else
+        throw std::runtime_error("Unknown command " + command);
+}
+
+std::vector<rec_entry> MSRDaemon::get_rec_list(daemon_device &device)
+{
+    {
+        std::lock_guard<std::mutex> guard(device.mutex);
+        if(device.have_rec_list)
+            return device.rec_list;
+    }
+    auto rec_list = device.msr->get_rec_list();
+    std::lock_guard<std::mutex> guard(device.mutex);
+    device.rec_list = rec_list;
+    device.have_rec_list = true;
+    return rec_list;
+}
+
+void MSRDaemon::print_sensors(daemon_device &device, const std::vector<sampletype> &types, std::ostream &out_stream)
+{
+    auto now = std::chrono::steady_clock::now();
+    std::vector<sampletype> missing;
+    {
+        std::lock_guard<std::mutex> guard(device.mutex);
+        for(auto type : types)
+        {
+            auto value = device.values.find(type);
+            if((value == device.values.end() || now - value->second.second > value_ttl) &&
+                std::find(missing.begin(), missing.end(), type) == missing.end())
+                missing.push_back(type);
+        }
+    }
+    if(missing.size())
+    {
+        auto values = device.msr->get_fresh_sensor_data(missing).values;
+        if(device.publisher)
+            device.publisher->publish(missing.data(), missing.size(), values.data());
+        std::lock_guard<std::mutex> guard(device.mutex);
+        for(size_t i = 0; i < missing.size(); i++)
+            device.values[missing[i]] = std::make_pair(values[i], now);
+    }
+    bool have_L1;
+    {
+        std::lock_guard<std::mutex> guard(device.mutex);
+        have_L1 = device.have_L1;
+    }
+    if(!have_L1 && std::find(types.begin(), types.end(), sampletype::light) != types.end())
+    {
+        std::string L1_unit = device.msr->get_L1_unit_str();
+        float L1_offset, L1_gain;
+        device.msr->get_L1_offset_gain(&L1_offset, &L1_gain);
+        std::lock_guard<std::mutex> guard(device.mutex);
+        device.L1_unit = L1_unit;
+        device.L1_offset = L1_offset;
+        device.L1_gain = L1_gain;
+        device.have_L1 = true;
+    }
+    std::lock_guard<std::mutex> guard(device.mutex);
+    for(auto type : types)
+        out_stream << device.msr->get_sensor_str(type, device.values[type].first, device.L1_unit, device.L1_offset, device.L1_gain);
+}
+
+void MSRDaemon::extract(daemon_device &device, uint32_t rec_num, std::string seperator, std::ostream &out_stream)
+{
+    auto rec_list = get_rec_list(device);
+    if(rec_num >= rec_list.size())
+        throw std::runtime_error("The requested recording is not on the device!");
+    const rec_entry &record = rec_list[rec_num];
+    if(record.isRecording)
+    {   //still growing, so it is not cached
+        device.msr->extract_record(record, seperator, out_stream);
+        return;
+    }
+    auto key = std::make_pair(record.address, seperator);
+    {
+        std::lock_guard<std::mutex> guard(device.mutex);
+        auto cached = device.extracted.find(key);
+        if(cached != device.extracted.end() && same_record(cached->second.first, record))
+        {
+            out_stream << cached->second.second;
+            return;
+        }
+    }
+    std::stringstream csv;
+    device.msr->extract_record(record, seperator, csv);
+    std::lock_guard<std::mutex> guard(device.mutex);
+    device.extracted[key] = std::make_pair(record, csv.str());
+    out_stream << device.extracted[key].second;
+}
+
+
+int msr145d_request(const std::string &socket_path, const std::vector<std::string> &fields, std::ostream &out_stream)
+{
+    stream_protocol::endpoint endpoint(socket_path);
+    stream_protocol::iostream stream(endpoint);
+    if(!stream)
+        throw std::runtime_error("Could not connect to msr145d at " + socket_path);
+    for(size_t i = 0; i < fields.size(); i++)
+        stream << (i ? "\t" : "") << fields[i];
+    stream << std::endl;
+    std::string line;
+    const size_t trailer_length = strlen(MSR145D_TRAILER);
+    bool first = true;
+    while(std::getline(stream, line))
+    {
+        if(line.compare(0, trailer_length, MSR145D_TRAILER) == 0)
+        {
+            out_stream.flush();
+            std::string result = line.substr(trailer_length);
+            if(result == "OK") return 0;
+            std::cerr << "ERROR: " << result.substr(std::min<size_t>(6, result.size())) << std::endl;
+            return 1;
+        }
+        //the newline after the last line is the one added by the daemon before the trailer
+        if(!first) out_stream << "\n";
+        out_stream << line;
+        first = false;
+        if(stream.rdbuf()->in_avail() == 0) out_stream.flush(); //pass on what we have while waiting for more
+    }
+    throw std::runtime_error("msr145d closed the connection without answering");
+}
@@ -12,7 +12,9 @@
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <deque>
 #include <iomanip>
+#include <thread>
 
 static const char *timeformat = "%Y:%m:%dT%H:%M:%S";
 
@@ -22,39 +24,73 @@ bool sampletype_cmp(sampletype &type1, sampletype &type2)
 }
 
 
-bool sample_cmp(sample &s1, sample &s2)
+void MSRTool::print_sensors(std::vector<sampletype> sensor_to_poll, std::ostream &out_stream)
 {
-    if(s1.timestamp == s2.timestamp)
-        return sampletype_cmp(s1.type, s2.type);
-    return s1.timestamp < s2.timestamp;
+    auto sensor_readings = get_fresh_sensor_data(sensor_to_poll).values;
+    std::string L1_unit;
+    float L1_offset = 0, L1_gain = 0;
+    if(std::find(sensor_to_poll.begin(), sensor_to_poll.end(), sampletype::light) != sensor_to_poll.end())
+    {   //only read the light settings once, and only if needed
+        L1_unit = get_L1_unit_str();
+        get_L1_offset_gain(&L1_offset, &L1_gain);
+    }
+    for(uint8_t i = 0; i < sensor_readings.size(); i++)
+    {
+        out_stream << get_sensor_str(sensor_to_poll[i], sensor_readings[i], L1_unit, L1_offset, L1_gain);
+    }
 }
 
+void MSRTool::stream_sensors(std::vector<sampletype> sensor_to_poll, float rate, float duration,
+    std::string seperator, std::ostream &out_stream)
+{   //Print rate readings per second as CSV, until duration seconds have passed (forever if 0)
+    std::string L1_unit;
+    float L1_offset = 0, L1_gain = 0;
+    if(std::find(sensor_to_poll.begin(), sensor_to_poll.end(), sampletype::light) != sensor_to_poll.end())
+    {
+        L1_unit = get_L1_unit_str();
+        get_L1_offset_gain(&L1_offset, &L1_gain);
+    }
+    out_stream << "Time (s)";
+    for(auto type : sensor_to_poll)
+    {
+        std::string type_str, unit_str;
+        get_type_str(type, type_str, unit_str);
+        if(type == sampletype::light) unit_str = L1_unit;
+        out_stream << seperator << type_str << " (" << unit_str << ")";
+    }
+    out_stream << std::endl;
+    out_stream.setf(std::ios::fixed, std::ios::floatfield);
+    out_stream.precision(3);
+
+    LiveStream stream(*this, sensor_to_poll, std::chrono::microseconds((int64_t)(1e6 / rate)));
+    auto start = std::chrono::steady_clock::now();
+    std::vector<unit_conversion> conversions;
+    for(auto type : sensor_to_poll)
+        conversions.push_back(type == sampletype::light ?
+            msr_unit_conversion(type, L1_gain, L1_offset) : msr_unit_conversion(type));
+    auto print_reading = [&] (const live_reading &reading)
+    {
+        out_stream << std::chrono::duration<double>(reading.time - start).count();
+        for(size_t i = 0; i < reading.count; i++)
+            out_stream << seperator << msr_convert_value(conversions[i], reading.values[i]);
+        out_stream << "\n";
+    };
+    stream.start();
+    while(duration == 0 || std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < duration)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        stream.drain(print_reading);
+        out_stream.flush();
+    }
+    stream.stop();
+    stream.drain(print_reading);
+    out_stream.flush();
+    std::cerr << "Readings: " << stream.get_readings() << ", overruns: " << stream.get_overruns()
+        << ", missed deadlines: " << stream.get_missed_deadlines() << ", errors: " << stream.get_errors() << std::endl;
+}
 
-void MSRTool::print_sensors(std::vector<sampletype> sensor_to_poll)
+void MSRTool::print_status(std::ostream &out_stream)
 {
-    update_sensors();
-    auto sensor_readings = get_sensor_data(sensor_to_poll);
-    for(uint8_t i = 0; i < sensor_readings.size(); i++)
-    {
-        std::cout << get_sensor_str(sensor_to_poll[i], sensor_readings[i]);
-    }
-}
-void MSRTool::print_status()
-{
-    update_sensors();
-    std::cout << "Device Status:" << std::endl << std::endl;
-    std::cout << "Serial Number:\t\t" << get_serial() << std::endl;
-    std::cout << "Firmware Version:\t" << get_firmware_version_str() << std::endl;
-    std::cout << "Device Name:\t\t" << get_name() << std::endl;
-    std::cout << "Device time:\t\t" << get_device_time_str() << std::endl;
-    std::cout << "Device is recording:\t" << is_recording() << std::endl;
-    bool marker_on, alarm_confirm_on;
-    get_marker_setting(&marker_on, &alarm_confirm_on);
-    std::cout << "Marker:\t\t\t" << marker_on << std::endl;
-    std::cout << "Alarm confirm:\t\t" <<  alarm_confirm_on << std::endl;
-    std::cout << "Sampling intervals:" << std::endl;
-    std::cout << get_interval_string() << std::endl;
-    std::cout << "Current sensor measurements:" << std::endl;
     std::vector<sampletype> sensor_to_poll;
     sensor_to_poll.push_back(sampletype::pressure);
     sensor_to_poll.push_back(sampletype::T_pressure);
@@ -62,15 +98,32 @@ void MSRTool::print_status()
     sensor_to_poll.push_back(sampletype::T_humidity);
     sensor_to_poll.push_back(sampletype::bat);
     if(light_sensor) sensor_to_poll.push_back(sampletype::light);
-    auto sensor_readings = get_sensor_data(sensor_to_poll);
-    for(uint8_t i = 0; i < sensor_readings.size(); i++)
-        std::cout << get_sensor_str(sensor_to_poll[i], sensor_readings[i]);
-    std::cout << std::endl;
-    std::cout << get_start_settings_str() << std::endl;
-    std::cout << "Limit settings:" << std::endl;
-    std::cout << get_limits_str() << std::endl;
-    std::cout << "Calibration settings:" << std::endl;
-    std::cout << get_calibration_str() << std::endl;
+    auto fresh = get_fresh_sensor_data(sensor_to_poll);
+    //Everything printed below comes from this snapshot, so no further commands are send.
+    //The sensors were just read, so the snapshot doesn't read them again.
+    auto snapshot = get_snapshot();
+    snapshot.sensor_types = sensor_to_poll;
+    snapshot.sensor_values = fresh.values;
+    out_stream << "Device Status:" << std::endl << std::endl;
+    out_stream << "Serial Number:\t\t" << snapshot.serial << std::endl;
+    out_stream << "Firmware Version:\t" << get_firmware_version_str(snapshot.firmware_major, snapshot.firmware_minor) << std::endl;
+    out_stream << "Device Name:\t\t" << snapshot.name << std::endl;
+    out_stream << "Device time:\t\t" << get_time_str(snapshot.device_time) << std::endl;
+    out_stream << "Device is recording:\t" << snapshot.recording << std::endl;
+    out_stream << "Marker:\t\t\t" << snapshot.marker_on << std::endl;
+    out_stream << "Alarm confirm:\t\t" <<  snapshot.alarm_confirm_on << std::endl;
+    out_stream << "Sampling intervals:" << std::endl;
+    out_stream << get_interval_string(snapshot) << std::endl;
+    out_stream << "Current sensor measurements:" << std::endl;
+    for(uint8_t i = 0; i < snapshot.sensor_values.size(); i++)
+        out_stream << get_sensor_str(snapshot.sensor_types[i], snapshot.sensor_values[i],
+            snapshot.L1_unit, snapshot.L1_offset, snapshot.L1_gain);
+    out_stream << std::endl;
+    out_stream << get_start_settings_str(snapshot) << std::endl;
+    out_stream << "Limit settings:" << std::endl;
+    out_stream << get_limits_str(snapshot) << std::endl;
+    out_stream << "Calibration settings:" << std::endl;
+    out_stream << get_calibration_str(snapshot) << std::endl;
 }
 
 void MSRTool::set_limit(sampletype type, float limit1, float limit2, limit_setting record_limit, limit_setting alarm_limit)
@@ -101,35 +154,37 @@ std::string MSRTool::get_firmware_version_str()
 {
     int major, minor;
     get_firmware_version(&major, &minor);
+    return get_firmware_version_str(major, minor);
+}
+
+std::string MSRTool::get_firmware_version_str(int major, int minor)
+{
     std::string version_str = "V" + std::to_string(major) + "." + std::to_string(minor);
     return version_str;
 }
 
 void MSRTool::set_name(std::string name)
 {
-    //First, read in calibration date and callibration name, as we need to set them at the same time.
-    uint8_t year, month, day, active_mask;
-    auto calib_name = get_calibration_name(&year, &month, &day, &active_mask);
-    //write them
-    set_names_and_calibration_date(name, calib_name, year, month, day, active_mask);
+    //apply takes care of writing the calibration name and date together with the name.
+    DeviceConfig config;
+    config.name = name;
+    apply(config);
 }
 void MSRTool::set_calib_name(std::string calib_name)
 {
-    //First, read in calibration date and device name, as we need to set them at the same time.
-    uint8_t year, month, day, active_mask;
-    auto device_name = get_calibration_name(&year, &month, &day, &active_mask);
-    //write them
-    set_names_and_calibration_date(device_name, calib_name, year, month, day, active_mask);
+    DeviceConfig config;
+    config.calibration_name = calib_name;
+    apply(config);
 }
 
 void MSRTool::set_calibration_date(uint16_t year, uint16_t month, uint16_t day)
 {
-    //read names first. We need to set them at the same time
-    uint8_t tmp0, tmp1, tmp2, active_mask;
-    auto calib_name = get_calibration_name(&tmp0, &tmp1, &tmp2, &active_mask);
-    auto device_name = get_name();
     //std::cout << year - 2000 << " " << month - 1 << " " << day - 1 << std::endl;
-    set_names_and_calibration_date(device_name, calib_name, year - 2000, month - 1, day - 1, active_mask);
+    DeviceConfig config;
+    config.calibration_year = year - 2000;
+    config.calibration_month = month - 1;
+    config.calibration_day = day - 1;
+    apply(config);
 }
 
 void MSRTool::set_measurement_and_timers(std::vector<measure_interval_pair> interval_typelist)
@@ -147,80 +202,143 @@ void MSRTool::set_measurement_and_timers(std::vector<measure_interval_pair> inte
         return;
     }
 
+    DeviceConfig config;
     for(auto &interval : interval_typelist)
     {
-        bool blink = false;
-        bool active = false;
-        uint8_t bitmask = 0x00;
+        timer_setting setting;
+        setting.blink = false;
+        setting.measurements = 0x00;
         for(auto &type : interval.second)
         {
-            if(type == active_measurement::blink) blink = true;
-            else bitmask |= type;
-            active = true;
+            if(type == active_measurement::blink) setting.blink = true;
+            else setting.measurements |= type;
         }
-        uint32_t timer_interval = interval.first * 512; //interval is in 1/512 seconds and rounded down.
-        set_timer_interval(timer, timer_interval);
-        set_timer_measurements(timer, bitmask, blink, active);
+        setting.interval = interval.first * 512; //interval is in 1/512 seconds and rounded down.
+        config.timers[timer] = setting;
         timer++;
     }
     for(; timer < 8; timer++) //zero out the remaining timers
     {
-        set_timer_interval(timer, 0);
-        set_timer_measurements(timer, 0, 0, 0);
+        timer_setting setting;
+        setting.interval = 0;
+        setting.measurements = 0x00;
+        setting.blink = false;
+        config.timers[timer] = setting;
     }
+    //only the timers which differ from the device are written
+    apply(config);
 }
 
-void MSRTool::list_recordings()
+void MSRTool::list_recordings(std::ostream &out_stream)
 {
-    auto rec_list = get_rec_list();
+    out_stream << get_recordings_str(get_rec_list());
+}
+
+std::string MSRTool::get_recordings_str(const std::vector<rec_entry> &rec_list)
+{
+    std::stringstream ret_str;
     char *date_str = new char[100];
-    std::cout << "Recordings on device:\n";
-    std::cout << "Number:\t\tDate:\t\t\tNumber of pages:\n\n";
+    ret_str << "Recordings on device:\n";
+    ret_str << "Number:\t\tDate:\t\t\tNumber of pages:\n\n";
     size_t i = 0;
     for(auto &rec : rec_list)
     {
         strftime(date_str, 100, timeformat, &rec.time);
-        std::cout << i++ << "\t\t" << date_str << "\t" << rec.length << std::endl;
+        ret_str << i++ << "\t\t" << date_str << "\t" << rec.length << std::endl;
     }
     delete[] date_str;
+    return ret_str.str();
 }
 
 void MSRTool::extract_record(uint32_t rec_num, std::string seperator, std::ostream &out_stream)
 {
     //First, get list of recordings
-    char *date_str = new char[100];
     auto rec_list = get_rec_list(rec_num + 1);
     if(rec_list.size() < rec_num + 1)
     {
         std::cout << "The requested recording is not on the device!" << std::endl;
     }
+    extract_record(rec_list[rec_num], seperator, out_stream);
+}
+
+size_t MSRTool::extract_record(const rec_entry &record, std::string seperator, std::ostream &out_stream)
+{
+    char *date_str = new char[100];
     //Grab the samples
-    strftime(date_str, 100, timeformat, &(rec_list[rec_num].time));
-    auto samples = get_samples(rec_list[rec_num]);
+    strftime(date_str, 100, timeformat, &(record.time));
+    auto samples = get_samples(record);
     out_stream << "Samples collected from an MSR145" << std::endl;
     out_stream << "Sampling start time: " << date_str << std::endl;
     out_stream << std::endl;
     out_stream << create_csv(samples, seperator);
+    delete[] date_str;
+    return samples.size();
 }
 
-std::string MSRTool::create_csv(std::vector<sample> &samples, std::string &seperator)
+size_t MSRTool::follow_record(const rec_entry &record, std::string seperator, std::ostream &out_stream, float interval)
 {
-    std::stringstream csv;
-    csv.setf(std::ios::fixed, std::ios::floatfield);
-    csv.precision(10);
-    std::vector<sampletype> sampletypes;
-    //Create header with info about types and units
+    char *date_str = new char[100];
+    strftime(date_str, 100, timeformat, &(record.time));
+    out_stream << "Samples collected from an MSR145" << std::endl;
+    out_stream << "Sampling start time: " << date_str << std::endl;
+    out_stream << std::endl;
+    delete[] date_str;
+    follow_cursor cursor;
+    csv_columns columns;
+    std::vector<sample> pending;
+    size_t sample_count = 0;
+    while(true)
+    {
+        auto samples = get_new_samples(record, cursor);
+        pending.insert(pending.end(), samples.begin(), samples.end());
+        if(pending.size())
+        {
+            if(columns.types.empty())
+            {
+                columns = get_csv_columns(pending);
+                out_stream << create_csv_header(columns, seperator);
+            }
+            //hold back the samples at the last timestamp, the rest of its line may come with the next poll
+            auto ready = pending.end();
+            if(!cursor.finished)
+                while(ready != pending.begin() && (ready - 1)->timestamp == pending.back().timestamp)
+                    ready--;
+            std::vector<sample> lines(pending.begin(), ready);
+            out_stream << create_csv_lines(lines, columns, seperator) << std::flush;
+            sample_count += lines.size();
+            pending.erase(pending.begin(), ready);
+        }
+        if(cursor.finished) break;
+        std::this_thread::sleep_for(std::chrono::microseconds((int64_t)(interval * 1e6)));
+    }
+    return sample_count;
+}
+
+csv_columns MSRTool::get_csv_columns(const std::vector<sample> &samples)
+{
+    csv_columns columns;
     for(auto &sample : samples)
     {
-        if(std::find(sampletypes.begin(), sampletypes.end(), sample.type) == std::end(sampletypes))
+        if(std::find(columns.types.begin(), columns.types.end(), sample.type) == std::end(columns.types))
         {
-            sampletypes.push_back(sample.type);
+            columns.types.push_back(sample.type);
         }
     }
-    std::sort(sampletypes.begin(), sampletypes.end(), sampletype_cmp);
+    std::sort(columns.types.begin(), columns.types.end(), sampletype_cmp);
+    if(std::find(columns.types.begin(), columns.types.end(), light) != columns.types.end())
+        get_L1_offset_gain(&columns.L1_offset, &columns.L1_gain);
+    columns.first_time = samples.size() ? samples[0].timestamp : 0;
+    for(auto &sample : samples)
+        columns.first_time = std::min<double>(columns.first_time, sample.timestamp);
+    return columns;
+}
+
+std::string MSRTool::create_csv_header(const csv_columns &columns, std::string &seperator)
+{
+    std::stringstream csv;
+    //Create header with info about types and units
     csv << "Timestamp (s)" << seperator;
-    float L1_gain, L1_offset;
-    for(auto &type : sampletypes)
+    for(auto &type : columns.types)
     {
         switch(type)
         {
@@ -238,7 +356,6 @@ std::string MSRTool::create_csv(std::vector<sample> &samples, std::string &seper
                 std::string type_str, unit_str;
                 get_type_str(type, type_str, unit_str);
                 unit_str = get_L1_unit_str();
-                get_L1_offset_gain(&L1_offset, &L1_gain);
                 csv << type_str << " (" << unit_str << ")" << seperator;
                 break;
             }
@@ -247,50 +364,153 @@ std::string MSRTool::create_csv(std::vector<sample> &samples, std::string &seper
         }
     }
     csv << std::endl;
-    //Create the sample lines
-    //sort samples according to time and type
-    std::sort(samples.begin(), samples.end(), sample_cmp);
-    std::unique(samples.begin(), samples.end(), sample_cmp);
-    uint64_t last_stamp = 0xFFFFFFFFFFFFFFFF;
-    size_t placement = 0;
-    double first_time = samples[0].timestamp;
-    for(auto &sample : samples)
+    return csv.str();
+}
+
+std::string MSRTool::create_csv_lines(const std::vector<sample> &samples, const csv_columns &columns, std::string &seperator)
+{   //samples should be in the order of the recording, as given by get_samples. Samples with the same timestamp
+    //are written as one line, so no sorting is needed. Each line starts with a newline.
+    std::stringstream csv;
+    csv.setf(std::ios::fixed, std::ios::floatfield);
+    csv.precision(10);
+    int column_of[16]; //column of each sampletype, -1 if it has none
+    std::fill(column_of, column_of + 16, -1);
+    for(size_t i = 0; i < columns.types.size(); i++)
+        column_of[columns.types[i] & 0x0F] = i;
+    auto get_column = [&column_of] (const sample &cur_sample)
     {
-        switch(sample.type)
+        switch(cur_sample.type)
         {
             case pressure: case T_pressure: case humidity:
             case T_humidity: case bat: case ext1: case ext2:
             case ext3: case ext4: case light:
-
-                if(sample.timestamp != last_stamp)
-                {
-                    placement = 0;
-                    last_stamp = sample.timestamp;
-                }
-                if(placement == 0)
-                {
-                    csv << std::endl;
-                    csv << (sample.timestamp - first_time) / double( (1 << 9) )  << seperator;
-                    //std::cout << sample.timestamp << std::endl;
-                    placement++;
-                }
-                while(sample.type != sampletypes[placement - 1])
-                {
-                    placement++;
-                    csv << seperator;
-                }
-                if(sample.type == light)
-                    csv << L1_offset + convert_to_unit(sample.type, sample.value, L1_gain);
-                else
-                    csv << convert_to_unit(sample.type, sample.value);
-                break;
+                return column_of[cur_sample.type & 0x0F]; //-1 only when following, a type which wasn't there at the start
             default:
-                break;
+                return -1;
+        }
+    };
+    //the values of each column are converted in one pass, with the L1 offset and gain folded into the conversion
+    std::vector<size_t> column_size(columns.types.size(), 0);
+    for(auto &sample : samples)
+    {
+        int column = get_column(sample);
+        if(column >= 0) column_size[column]++;
+    }
+    std::vector<std::vector<int16_t> > raw_columns(columns.types.size());
+    std::vector<std::vector<float> > converted(columns.types.size());
+    for(size_t i = 0; i < columns.types.size(); i++)
+    {
+        raw_columns[i].reserve(column_size[i]);
+        converted[i].resize(column_size[i]);
+    }
+    for(auto &sample : samples)
+    {
+        int column = get_column(sample);
+        if(column >= 0) raw_columns[column].push_back(sample.value);
+    }
+    for(size_t i = 0; i < columns.types.size(); i++)
+    {
+        unit_conversion conversion = columns.types[i] == light ?
+            msr_unit_conversion(light, columns.L1_gain, columns.L1_offset) : msr_unit_conversion(columns.types[i]);
+        msr_convert_column(conversion, raw_columns[i].data(), raw_columns[i].size(), converted[i].data());
+    }
+    //Lines are kept in a small window ordered by timestamp, so samples which come a bit out of order still join
+    //their line. A sample older than a written line is written late, and a second sample of a type at the same
+    //timestamp gets a line of its own. Both are counted and warned about, nothing is dropped.
+    struct csv_line
+    {
+        uint64_t timestamp;
+        std::vector<float> values;
+        std::vector<bool> has_value;
+        int last_column; //the last column with a value
+    };
+    std::deque<csv_line> lines;
+    std::vector<csv_line> spare_lines; //written lines, whose vectors are reused
+    uint64_t last_written = 0;
+    bool have_written = false;
+    size_t late = 0, duplicates = 0;
+    auto write_line = [&] ()
+    {
+        csv_line &line = lines.front();
+        csv << std::endl;
+        csv << (line.timestamp - columns.first_time) / double( (1 << 9) )  << seperator;
+        for(int i = 0; i <= line.last_column; i++)
+        {
+            if(i) csv << seperator;
+            if(line.has_value[i]) csv << line.values[i];
+        }
+        last_written = line.timestamp;
+        have_written = true;
+        spare_lines.push_back(std::move(line));
+        lines.pop_front();
+    };
+    std::vector<size_t> next_value(columns.types.size(), 0);
+    for(auto &sample : samples)
+    {
+        int column = get_column(sample);
+        if(column < 0)
+            continue;
+        if(have_written && sample.timestamp <= last_written)
+            late++;
+        //the line of the timestamp with the column free, searched from the newest line, as most samples go there
+        size_t insert_at = lines.size();
+        csv_line *line = nullptr;
+        bool same_stamp = false;
+        for(size_t i = lines.size(); i-- > 0 && lines[i].timestamp >= sample.timestamp; )
+        {
+            if(lines[i].timestamp == sample.timestamp)
+            {
+                if(!same_stamp) insert_at = i + 1; //after the lines of the timestamp
+                same_stamp = true;
+                if(!lines[i].has_value[column]) line = &lines[i];
+            }
+            else
+                insert_at = i;
         }
+        if(!line)
+        {
+            if(same_stamp)
+                duplicates++;
+            csv_line new_line;
+            if(spare_lines.size())
+            {
+                new_line = std::move(spare_lines.back());
+                spare_lines.pop_back();
+                std::fill(new_line.has_value.begin(), new_line.has_value.end(), false);
+            }
+            else
+            {
+                new_line.values.resize(columns.types.size());
+                new_line.has_value.resize(columns.types.size(), false);
+            }
+            new_line.timestamp = sample.timestamp;
+            new_line.last_column = -1;
+            line = &*lines.insert(lines.begin() + insert_at, std::move(new_line));
+        }
+        line->values[column] = converted[column][next_value[column]++];
+        line->has_value[column] = true;
+        line->last_column = std::max(line->last_column, column);
+        if(lines.size() > MSR_CSV_REORDER_LINES)
+            write_line();
     }
+    while(lines.size())
+        write_line();
+    if(late)
+        std::cerr << "Warning: " << late << " samples came after the line of their timestamp or a later one was written, "
+            "and are written out of time order" << std::endl;
+    if(duplicates)
+        std::cerr << "Warning: " << duplicates << " samples had a type already in the line of their timestamp, "
+            "and are written in a line of their own" << std::endl;
     return csv.str();
 }
 
+std::string MSRTool::create_csv(std::vector<sample> &samples, std::string &seperator)
+{
+    MSR_ScopedTimer decode_timer(metrics.decode_time);
+    auto columns = get_csv_columns(samples);
+    return create_csv_header(columns, seperator) + create_csv_lines(samples, columns, seperator);
+}
+
 void MSRTool::get_type_str(sampletype type, std::string &type_str, std::string &unit_str)
 {
     switch(type)
@@ -329,82 +549,73 @@ void MSRTool::get_type_str(sampletype type, std::string &type_str, std::string &
     }
 }
 
-std::string MSRTool::get_calibration_type_str(active_calibrations::active_calibrations type)
+std::string MSRTool::get_calibration_type_str(active_calibrations::active_calibrations type, const DeviceSnapshot &snapshot)
 {
     std::stringstream ret_str;
     std::string type_str, unit_str;
     sampletype s_type;
-    calibration_type::calibration_type c_type;
+    const calibration_points *points;
     switch(type)
     {
         case active_calibrations::humidity:
             s_type = sampletype::humidity;
-            c_type = calibration_type::humidity;
+            points = &snapshot.humidity_calibration;
             break;
         case active_calibrations::temperature_T:
             s_type = sampletype::ext1;
-            c_type = calibration_type::temperature;
+            points = &snapshot.temperature_calibration;
             break;
         case active_calibrations::temperature_RH:
             s_type = sampletype::T_humidity;
-            c_type = calibration_type::temperature;
+            points = &snapshot.temperature_calibration;
             break;
         default:
             assert(false);
     }
     //std::cout << int(s_type) << std::endl;
-    uint16_t point_1_target, point_1_actual, point_2_target, point_2_actual;
-
-    get_calibrationdata(c_type, &point_1_target, &point_1_actual,
-                    &point_2_target, &point_2_actual);
-
     get_type_str(s_type, type_str, unit_str);
     ret_str << "\tCalibration for " << type_str << " (" << unit_str << ") :";
     while(ret_str.str().size() < 40  ) ret_str << " ";
-    ret_str << "P1_Target: " << convert_to_unit(s_type, point_1_target) << " ";
-    ret_str << "P1_Actual: " << convert_to_unit(s_type, point_1_actual) << " ";
-    ret_str << "P2_Target: " << convert_to_unit(s_type, point_2_target) << " ";
-    ret_str << "P2_Actual: " << convert_to_unit(s_type, point_2_actual) << " ";
+    ret_str << "P1_Target: " << convert_to_unit(s_type, points->point_1_target) << " ";
+    ret_str << "P1_Actual: " << convert_to_unit(s_type, points->point_1_actual) << " ";
+    ret_str << "P2_Target: " << convert_to_unit(s_type, points->point_2_target) << " ";
+    ret_str << "P2_Actual: " << convert_to_unit(s_type, points->point_2_actual) << " ";
     return ret_str.str();
 }
 
-std::string MSRTool::get_calibration_str()
+std::string MSRTool::get_calibration_str(const DeviceSnapshot &snapshot)
 {   //Return string with calibraion data
     std::stringstream ret_str;
     std::stringstream date_str;
-    //first, get the name, date and mask
-    uint8_t year, month, day, active_mask;
-    ret_str << "\tCalibration name:\t" << get_calibration_name(&year, &month, &day, &active_mask) << std::endl;
-    date_str << (uint16_t)year + 2000 << ":";
-    date_str << std::setw(2) << std::setfill('0') << month + 1;
+    uint8_t active_mask = snapshot.active_calibrations;
+    ret_str << "\tCalibration name:\t" << snapshot.calibration_name << std::endl;
+    date_str << (uint16_t)snapshot.calibration_year + 2000 << ":";
+    date_str << std::setw(2) << std::setfill('0') << snapshot.calibration_month + 1;
     date_str << ":";
-    date_str << std::setw(2) << std::setfill('0') << day + 1;
+    date_str << std::setw(2) << std::setfill('0') << snapshot.calibration_day + 1;
     ret_str << "\tCalibration date:\t"   << date_str.str() << std::endl;
-    std::vector<active_calibrations::active_calibrations> types;
     if(active_mask & active_calibrations::humidity)
-        ret_str << get_calibration_type_str(active_calibrations::humidity) << std::endl;
+        ret_str << get_calibration_type_str(active_calibrations::humidity, snapshot) << std::endl;
     if(active_mask & active_calibrations::temperature_T)
-        ret_str << get_calibration_type_str(active_calibrations::temperature_T) << std::endl;
+        ret_str << get_calibration_type_str(active_calibrations::temperature_T, snapshot) << std::endl;
     if(active_mask & active_calibrations::temperature_RH)
-        ret_str << get_calibration_type_str(active_calibrations::temperature_RH) << std::endl;
+        ret_str << get_calibration_type_str(active_calibrations::temperature_RH, snapshot) << std::endl;
     return ret_str.str();
 }
-std::string MSRTool::get_limits_str()
+std::string MSRTool::get_limits_str(const DeviceSnapshot &snapshot)
 {
     std::stringstream ret_str;
-    uint16_t activated_limits = get_general_lim_settings();
-    for(uint8_t i = 0; i < 0xF; i++) //run through all the types
+    for(auto &limit : snapshot.limits) //run through all the active limits
     {
-        if(!(activated_limits & 1 << i)) continue;
-        switch(i)
+        switch(limit.type)
         {
             case sampletype::pressure: case sampletype::T_pressure:
             case sampletype::humidity: case sampletype::T_humidity:
             case sampletype::bat: case sampletype::light:
-                ret_str << get_sample_limit_str((sampletype)i);
+                ret_str << get_sample_limit_str(limit);
                 break;
             default:
-                std::cout << "unknown limit type: " << (int)i << std::endl;
+                std::cout << "unknown limit type: " << (int)limit.type << std::endl;
         }
     }
     if(ret_str.str().size())
@@ -413,19 +624,16 @@ std::string MSRTool::get_limits_str()
         return std::string("\tNone\n");
 }
 
-std::string MSRTool::get_sample_limit_str(sampletype type)
+std::string MSRTool::get_sample_limit_str(const limit_entry &limit)
 {
     std::string type_str;
     std::string unit_str;
-    get_type_str(type, type_str, unit_str);
+    get_type_str(limit.type, type_str, unit_str);
     std::stringstream ret_str;
     ret_str << "\tLimits for " << type_str << std::endl;
-    uint8_t rec_settings, alarm_settings;
-    uint16_t limit1, limit2;
-    get_sample_lim_setting(type, &rec_settings, &alarm_settings, &limit1, &limit2);
-    ret_str << "\t\tL1 = " << convert_to_unit(type, limit1) << " " << unit_str << ", L2 = "
-        << convert_to_unit(type, limit2) << " " << unit_str << std::endl;
-    switch(rec_settings)
+    ret_str << "\t\tL1 = " << convert_to_unit(limit.type, limit.limit1) << " " << unit_str << ", L2 = "
+        << convert_to_unit(limit.type, limit.limit2) << " " << unit_str << std::endl;
+    switch(limit.rec_settings)
     {
         case rec_less_limit2:
             ret_str << "\t\tRecord Limit: S<L2" << std::endl;
@@ -447,7 +655,7 @@ std::string MSRTool::get_sample_limit_str(sampletype type)
             break;
     }
 
-    switch(alarm_settings)
+    switch(limit.alarm_settings)
     {
         case alarm_less_limit1:
             ret_str << "\t\tAlarm Limit: S<L1" << std::endl;
@@ -465,16 +673,13 @@ std::string MSRTool::get_sample_limit_str(sampletype type)
     return ret_str.str();
 }
 
-std::string MSRTool::get_start_settings_str()
+std::string MSRTool::get_start_settings_str(const DeviceSnapshot &snapshot)
 {
     std::stringstream ret_str;
-    bool bufferon;
-    startcondition startcon;
-    get_start_setting(&bufferon, &startcon);
     ret_str << "Settings for start:\n";
-    ret_str << "\tRingbuffer on: " << bufferon << std::endl;
+    ret_str << "\tRingbuffer on: " << snapshot.bufferon << std::endl;
     ret_str << "\tStartsetting:\t";
-    switch(startcon)
+    switch(snapshot.start)
     {
         case startcondition::now:
             ret_str << "Start imidediately" << std::endl;
@@ -486,33 +691,43 @@ std::string MSRTool::get_start_settings_str()
             ret_str << "Start and stop on button push" << std::endl;
             break;
         case startcondition::time_start:
-            ret_str << "Start on\t" << get_start_time_str() << std::endl;
+            ret_str << "Start on\t" << get_time_str(snapshot.start_time) << std::endl;
             break;
         case startcondition::time_stop:
             ret_str << "Start imidediately" << std::endl;
-            ret_str << "\t\t\tStop on\t\t" << get_end_time_str() << std::endl;
+            ret_str << "\t\t\tStop on\t\t" << get_time_str(snapshot.end_time) << std::endl;
             break;
         case startcondition::time_start_stop:
-            ret_str << "Start on\t" << get_start_time_str() << std::endl;
-            ret_str << "\t\t\tStop on\t\t" << get_end_time_str() << std::endl;
+            ret_str << "Start on\t" << get_time_str(snapshot.start_time) << std::endl;
+            ret_str << "\t\t\tStop on\t\t" << get_time_str(snapshot.end_time) << std::endl;
             break;
     }
     return ret_str.str();
 }
 
 std::string MSRTool::get_sensor_str(sampletype type, int16_t value)
+{
+    std::string L1_unit;
+    float L1_offset = 0, L1_gain = 0;
+    if(type == sampletype::light)
+    {
+        L1_unit = get_L1_unit_str();
+        get_L1_offset_gain(&L1_offset, &L1_gain);
+    }
+    return get_sensor_str(type, value, L1_unit, L1_offset, L1_gain);
+}
+
+std::string MSRTool::get_sensor_str(sampletype type, int16_t value, const std::string &L1_unit, float L1_offset, float L1_gain)
 {
     std::stringstream ret_str;
     std::string type_str, unit_str;
     get_type_str(type, type_str, unit_str);
-    if(type == sampletype::light) unit_str = get_L1_unit_str();
+    if(type == sampletype::light) unit_str = L1_unit;
     ret_str << "\t" << type_str << " (" << unit_str << "):";
     while(ret_str.str().size() < 30) ret_str << " ";
     if(type == sampletype::light)
     {
-        float offset, gain;
-        get_L1_offset_gain(&offset, &gain);
-        ret_str << std::fixed << std::setprecision(10) << offset + convert_to_unit(type, value, gain);
+        ret_str << std::fixed << std::setprecision(10) << L1_offset + convert_to_unit(type, value, L1_gain);
     }
     else
         ret_str << std::fixed << std::setprecision(10) << convert_to_unit(type, value);
@@ -523,37 +738,9 @@ std::string MSRTool::get_sensor_str(sampletype type, int16_t value)
 }
 
 float MSRTool::convert_to_unit(sampletype type, int16_t value, float conversion_factor)
-{
+{   //for whole columns, use msr_convert_column instead
     if(conversion_factor != 0) return value * conversion_factor;
-    switch(type)
-    {
-        case pressure:
-            //returns in unit of mbar
-            return value/10.;
-        case T_pressure:
-            //return in ⁰C
-            return value/10.;
-        case humidity:
-            //return in %
-            return value/100.;
-        case T_humidity:
-            //return in ⁰C
-            return value/100.;
-        case bat:
-            //return in unit of volts. There is a pretty weird conversion factor for some reason.
-            //The factor is not really vertified to be "the correct one".
-
-            return value/682.5; //not figured out yet
-        case light:
-            return value * 6.5865478515625;
-        case ext1: case ext2: case ext3: case ext4:
-            return value;
-
-        default:
-            //return 0;
-            assert(false); //this should not happen
-    }
-    return 0.;
+    return value * msr_unit_scale(type);
 }
 
 void MSRTool::set_calibrationpoints(active_calibrations::active_calibrations type, std::vector<float> points)
@@ -565,10 +752,9 @@ void MSRTool::set_calibrationpoints(active_calibrations::active_calibrations typ
     }
     //get current data for active calibrations
     uint8_t year, month, day, active_mask;
-    std::string calibName = get_calibration_name(&year, &month, &day, &active_mask);
-    std::string deviceName = get_name();
+    get_calibration_name(&year, &month, &day, &active_mask);
     sampletype s_type;
-    calibration_type::calibration_type c_type;
+    DeviceConfig config;
     bool disable = (points[0] == 0 && points[1] == 0 && points[2] == 0 && points[3] == 0);
     if(disable)
     {
@@ -580,27 +766,29 @@ void MSRTool::set_calibrationpoints(active_calibrations::active_calibrations typ
     {
         case active_calibrations::humidity:
             s_type = sampletype::humidity;
-            c_type = calibration_type::humidity;
             break;
         case active_calibrations::temperature_T:
             s_type = sampletype::ext1;
-            c_type = calibration_type::temperature;
             //if(active_mask & type) active_mask &= ~active_calibrations::temperature_RH;
             break;
         case active_calibrations::temperature_RH:
             s_type = sampletype::T_humidity;
-            c_type = calibration_type::temperature;
             //if(active_mask & type) active_mask &= ~active_calibrations::temperature_T;
             break;
         default:
             assert(false);
     }
-    set_names_and_calibration_date(deviceName, calibName, year, month, day, active_mask);
-    MSR_Writer::set_calibrationdata(c_type,
-        convert_from_unit(s_type, points[0]),
-        convert_from_unit(s_type, points[1]),
-        convert_from_unit(s_type, points[2]),
-        convert_from_unit(s_type, points[3]));
+    calibration_points c_points;
+    c_points.point_1_target = convert_from_unit(s_type, points[0]);
+    c_points.point_1_actual = convert_from_unit(s_type, points[1]);
+    c_points.point_2_target = convert_from_unit(s_type, points[2]);
+    c_points.point_2_actual = convert_from_unit(s_type, points[3]);
+    config.active_calibrations = active_mask;
+    if(type == active_calibrations::humidity)
+        config.humidity_calibration = c_points;
+    else
+        config.temperature_calibration = c_points;
+    apply(config);
 
 }
 
@@ -610,7 +798,7 @@ int16_t MSRTool::convert_from_unit(sampletype type, int16_t value, float convers
     return returnval;
 }
 
-std::string MSRTool::get_interval_string()
+std::string MSRTool::get_interval_string(const DeviceSnapshot &snapshot)
 {
     std::stringstream return_str;
     return_str.precision(3);
@@ -623,10 +811,9 @@ std::string MSRTool::get_interval_string()
     std::vector<double> light_intervals;
     for(uint8_t i = 0; i < 8; i++)
     {
-        auto interval = get_timer_interval(i) / 512.;
-        uint8_t active_samples = 0;
-        bool blink = false;
-        get_active_measurements(i, &active_samples, &blink);
+        auto interval = snapshot.timers[i].interval / 512.;
+        uint8_t active_samples = snapshot.timers[i].measurements;
+        bool blink = snapshot.timers[i].blink;
         //std::cout << (int)active_samples << "\t" << interval << std::endl;
         if(blink)
             blink_intervals.push_back(interval);
@@ -699,7 +886,11 @@ std::string MSRTool::get_end_time_str()
 
 std::string MSRTool::get_time_str(struct tm(MSRTool::*get_func)(void))
 {
-    struct tm _time = (this->*get_func)();
+    return get_time_str((this->*get_func)());
+}
+
+std::string MSRTool::get_time_str(struct tm _time)
+{
     char *_time_str = new char[100];
     strftime(_time_str, 100, timeformat, &_time);
     std::string ret_str = _time_str;
@@ -748,3 +939,69 @@ void MSRTool::start_recording(startcondition start_option, bool ringbuff)
 {
     start_recording(start_option, nullptr, nullptr, ringbuff);
 }
+
+void MSRTool::bench_link(bool csv)
+{   //Measure the link to the device at each baudrate.
+    //Small commands are timed with get_firmware_version, throughput with full page fetches.
+    const uint32_t baudrates[] = {9600, 19200, 38400, 57600, 115200, 230400};
+    const size_t rtt_count = 50;
+    const size_t page_count = 8;
+    std::vector<uint8_t> response(0x0422);
+    uint8_t fetch_command[] = {0x8B, 0x00, 0x00, 0x00, 0x00, 0x20, 0x04};
+    std::cout.setf(std::ios::fixed, std::ios::floatfield);
+    std::cout.precision(2);
+    if(csv)
+        std::cout << "baud,rtt_p50_ms,rtt_p90_ms,rtt_p99_ms,rtt_max_ms,page_bytes_per_s,line_bytes_per_s,efficiency,error_rate,busy_rate" << std::endl;
+    else
+        std::cout << "Baud\tRTT p50/p90/p99/max (ms)\tPages (B/s)\tLine (B/s)\tEfficiency\tErrors\tBusy" << std::endl;
+    for(auto baud : baudrates)
+    {
+        if(baud != MSR_BUAD_RATE && !transport->can_set_baud()) continue;
+        uint64_t commands_before = metrics.get_total_commands();
+        uint64_t timeouts_before = metrics.timeouts;
+        uint64_t crc_failures_before = metrics.crc_failures;
+        uint64_t busy_before = metrics.busy;
+        std::vector<double> rtts;
+        double page_rate = 0;
+        double line_rate = baud / 10.; //start bit, 8 data bits, stop bit
+        try
+        {
+            set_baud(baud);
+            int major, minor;
+            for(size_t i = 0; i < rtt_count; i++)
+            {
+                auto start = std::chrono::steady_clock::now();
+                get_firmware_version(&major, &minor);
+                rtts.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            }
+            auto start = std::chrono::steady_clock::now();
+            for(size_t i = 0; i < page_count; i++)
+            {
+                fetch_command[3] = i;
+                send_command(fetch_command, sizeof(fetch_command), response.data(), response.size());
+            }
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            page_rate = page_count * (sizeof(fetch_command) + 1 + response.size()) / elapsed;
+        }
+        catch(msr_error &e)
+        {
+            std::cerr << baud << ": " << e.what() << std::endl;
+        }
+        std::sort(rtts.begin(), rtts.end());
+        auto percentile = [&rtts] (double p) { return rtts.size() ? rtts[std::min(rtts.size() - 1, (size_t)(p * rtts.size()))] : 0.; };
+        //every attempt is either answered, or times out
+        uint64_t timeouts = metrics.timeouts - timeouts_before;
+        uint64_t attempts = std::max<uint64_t>(metrics.get_total_commands() - commands_before + timeouts, 1);
+        double error_rate = (double)(timeouts + metrics.crc_failures - crc_failures_before) / attempts;
+        double busy_rate = (double)(metrics.busy - busy_before) / attempts;
+        if(csv)
+            std::cout << baud << "," << percentile(0.5) << "," << percentile(0.9) << "," << percentile(0.99) << ","
+                << percentile(1) << "," << page_rate << "," << line_rate << "," << page_rate / line_rate << ","
+                << error_rate << "," << busy_rate << std::endl;
+        else
+            std::cout << baud << "\t" << percentile(0.5) << "/" << percentile(0.9) << "/" << percentile(0.99) << "/"
+                << percentile(1) << "\t\t" << page_rate << "\t" << line_rate << "\t\t" << page_rate / line_rate * 100 << "%\t\t"
+                << error_rate * 100 << "%\t" << busy_rate * 100 << "%" << std::endl;
+    }
+    set_baud(MSR_BUAD_RATE);
+}
@@ -0,0 +1,109 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <stefan@stefanrvo.dk> wrote this file.  As long as you retain this notice you
+ * can do whatever you want with this stuff. If we meet some day, and you think
+ * this stuff is worth it, you can buy me a beer in return.
+ * ----------------------------------------------------------------------------
+ */
+
+//Keeps MSR145 devices open, and serves requests from msr145_tool --socket <socket>.
+//Usage: msr145d -D <port>... [--socket <socket>] [--baud <baudrate>] [--keepalive <seconds>] [--publish <rate>] [--metrics <port>]
+
+#include "msr145_daemon.hpp"
+#include <boost/program_options.hpp>
+#include <csignal>
+#include <iostream>
+#include <pthread.h>
+
+#define COMMAND_LINE_ERROR 1
+#define UNHANDLED_EXCEPTION 2
+
+namespace po = boost::program_options;
+
+struct signal_thread_guard
+{   //When run returns without a signal, or throws, the signal thread still waits in sigwait.
+    //Wake it before joining. It only calls stop, which does nothing the second time.
+    std::thread &thread;
+    ~signal_thread_guard()
+    {
+        pthread_kill(thread.native_handle(), SIGTERM);
+        thread.join();
+    }
+};
+
+int main(int argc, char const **argv)
+{
+    po::options_description desc("Usage");
+    desc.add_options()
+        ("help,h", "Print help messages")
+        ("device,D", po::value<std::vector<std::string> >()->multitoken()->required(), "Serial devices attached to MSR145s. Wildcards like /dev/ttyUSB* are allowed")
+        ("socket", po::value<std::string>()->default_value(MSR145D_DEFAULT_SOCKET), "The UNIX socket to serve the clients on")
+        ("baud", po::value<uint32_t>()->default_value(230400), "The baudrate the devices are kept at")
+        ("keepalive", po::value<float>()->default_value(2), "Seconds between the status reads which keep the devices at the baudrate")
+        ("publish", po::value<float>()->implicit_value(0), "Write the sensor values to shared memory (" MSR_SHM_PREFIX "<serial>) for MSR_ShmReader. Pressure, temperatures and humidity are read the given number of times per second, if given")
+        ("metrics", po::value<uint16_t>()->implicit_value(9145), "Serve the sensor values and link statistics to Prometheus at http://<metrics-address>:<port>/metrics")
+        ("metrics-address", po::value<std::string>()->default_value("127.0.0.1"), "Address to serve the metrics on (--metrics required)");
+    po::variables_map vm;
+    try
+    {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if(vm.count("help"))
+        {
+            std::cout << std::endl << "Daemon keeping MSR145 devices open for msr145_tool --socket" << std::endl
+            << desc << std::endl;
+            return 0;
+        }
+        po::notify(vm);
+        if(vm["keepalive"].as<float>() <= 0)
+            throw po::error("The keepalive interval must be larger than 0");
+        if(vm.count("publish") && vm["publish"].as<float>() < 0)
+            throw po::error("The publish rate can't be negative");
+    }
+    catch(po::error &e)
+    {
+        std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+        std::cerr << desc << std::endl;
+        return COMMAND_LINE_ERROR;
+    }
+    try
+    {
+        //the signals are taken by a thread of our own, so the other threads must not get them
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        MSRDaemon daemon(expand_port_patterns(vm["device"].as<std::vector<std::string> >()), vm["socket"].as<std::string>(),
+            vm["baud"].as<uint32_t>(), std::chrono::milliseconds((int64_t)(vm["keepalive"].as<float>() * 1000)));
+        if(vm.count("publish"))
+        {
+            float rate = vm["publish"].as<float>();
+            daemon.publish({sampletype::pressure, sampletype::T_pressure, sampletype::humidity, sampletype::T_humidity},
+                std::chrono::microseconds(rate > 0 ? (int64_t)(1000000 / rate) : 0));
+        }
+        if(vm.count("metrics"))
+        {
+            daemon.serve_metrics(vm["metrics"].as<uint16_t>(), vm["metrics-address"].as<std::string>());
+            std::cerr << "Serving metrics on http://" << vm["metrics-address"].as<std::string>() << ":"
+                << vm["metrics"].as<uint16_t>() << "/metrics" << std::endl;
+        }
+        std::thread signal_thread([&signals, &daemon] ()
+        {
+            int signal;
+            sigwait(&signals, &signal);
+            daemon.stop();
+        });
+        signal_thread_guard join_signal_thread{signal_thread};
+        std::cerr << "Serving " << daemon.get_device_count() << " devices on " << vm["socket"].as<std::string>() << std::endl;
+        daemon.run();
+    }
+    catch(std::exception &e)
+    {
+        std::cerr << "An error occured:\n\n" << e.what()
+        << "\nBailing out!" << std::endl;
+        return UNHANDLED_EXCEPTION;
+    }
+    return 0;
+}
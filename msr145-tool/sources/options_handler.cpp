@@ -25,13 +25,16 @@ options_handler::options_handler(bool _device_required)
     desc = new po::options_description("Usage");
     if(device_required == false)
         desc->add_options()
-        ("device,D", po::value<std::string>(), "Serial device attached to the MSR145");
+        ("device,D", po::value<std::string>(), "Serial device attached to the MSR145, serial:<serial number> to find the device by its serial number, tcp:<host>:<port> for a network serial server, or replay:<trace> to replay a captured trace");
     else
         desc->add_options()
-        ("device,D", po::value<std::string>()->required(), "Serial device attached to the MSR145");
+        ("device,D", po::value<std::string>()->required(), "Serial device attached to the MSR145, serial:<serial number> to find the device by its serial number, tcp:<host>:<port> for a network serial server, or replay:<trace> to replay a captured trace");
 
     desc->add_options()
         ("help,h", "Print help messages")
+        ("capture", po::value<std::string>(), "Record all communication with the device to the given trace file")
+        ("stats", "Print statistics about the communication with the device when done")
+        ("bench-link", po::value<std::string>()->implicit_value("table"), "Measure round trip times, page throughput and error rates at each baudrate. Give 'csv' as argument for machine readable output")
         ("stop", "Stop recording samples")
         ("start", "Start recording samples")
         ("ringbuffer", "Should the device use a ringbuffer when running out of memory? (--start required)")
@@ -42,10 +45,18 @@ options_handler::options_handler(bool _device_required)
         ("status,s", "Print current settings of the MSR145")
         ("rawcmd", po::value<std::vector<std::string> >()->multitoken(), "Send a raw command to the device and read the answer. last argument in list is lenght of answer")
         ("format", "Format the memory")
+        ("fastformat", "Format the memory, only erasing the parts used by recordings. Use --format if this fails")
         ("list,l", "List the recordings on the device.")
         ("extract,X", po::value<uint32_t>(),     "extract a recording from the device, the record number is given as argument")
         ("seperator", po::value<std::string>(), "The seperator used when extracting")
         ("outfile,o", po::value<std::string>(), "The file extracted to, default is stdout")
+        ("follow", po::value<float>()->implicit_value(1), "Keep extracting the samples added to an active recording every given number of seconds (default 1), until it is stopped (--extract required)")
+        ("harvest", po::value<std::vector<std::string> >()->multitoken(), "Extract all recordings from the given devices at once. Wildcards like /dev/ttyUSB* are allowed. The files are named <serial>_<record number>.csv")
+        ("jobs,j", po::value<size_t>(), "Maximum number of devices to harvest at once, default is 8 (--harvest required)")
+        ("outdir", po::value<std::string>(), "Directory to harvest to, default is the current directory (--harvest required)")
+        ("discover", po::value<std::vector<std::string> >()->multitoken()->zero_tokens(), "Find the devices on the given ports, default is /dev/ttyUSB* and /dev/ttyACM*")
+        ("portcache", po::value<std::string>(), "File caching the ports of the devices found by --discover, default is ~/.msr145_ports")
+        ("socket", po::value<std::string>()->implicit_value(MSR145D_DEFAULT_SOCKET), "Send --status, --getsensors, --list and --extract to msr145d on the given socket (default " MSR145D_DEFAULT_SOCKET "), which has the device open. The device is given by its port or serial number")
         ("pressure",  po::value<std::vector<float> >()->multitoken(), "Record pressure. Arguments are intervals (--setsampling required)")
         ("light",  po::value<std::vector<float> >()->multitoken(), "Record light level. Arguments are intervals (--setsampling required)")
         ("humidity",  po::value<std::vector<float> >()->multitoken(), "Record humidity. Arguments are intervals (--setsampling required)")
@@ -68,6 +79,8 @@ options_handler::options_handler(bool _device_required)
         ("clearlimits", "clear all limits")
         ("light_sensor", "Tell the driver that the device contains a light sensor.")
         ("getsensors", po::value<std::vector<std::string> >()->multitoken(), "get the newest reading from the sensors. Arguments are '(L)light', '(p)pressure', '(T_p)temp_pressure', '(RH)humidity', '(T_RH)temp_humidity' or B(battery)")
+        ("stream", po::value<float>(), "Read the sensors given by --getsensors (default pressure, temperatures and humidity) the given number of times per second, and print them as CSV")
+        ("duration", po::value<float>(), "Number of seconds to stream for, default is until stopped (--stream required)")
         /*("set_light_unit", po::value<std::string>(), "Set the name of the unit for the light sensor")*/
         ;
         if(device_required)
@@ -99,13 +112,32 @@ int options_handler::handle_command(po::variables_map &vm, MSRTool *&msr)
         std::cout << "\nFormat for time is YYYY:MM:DDTHH:MM:SS\n";
         return 0;
     }
+    if(vm.count("harvest"))
+    {   //doesn't need the device argument, so we handle it before checking for required arguments
+        return handle_harvest_args(vm);
+    }
+    if(vm.count("discover"))
+    {
+        return handle_discover_args(vm);
+    }
     po::notify(vm);
+    if(vm.count("socket"))
+    {   //the daemon has the device open, so don't open it here
+        return handle_client_args(vm);
+    }
     if(vm.count("device"))
     {
         if(msr)
             delete msr;
 
-        msr = new MSRTool(vm["device"].as<std::string>());
+        std::string device = vm["device"].as<std::string>();
+        if(device.compare(0, 7, "serial:") == 0)
+            device = MSR_Discovery(get_port_cache(vm)).resolve(device.substr(7));
+        msr = new MSRTool(device);
+    }
+    if(vm.count("capture"))
+    {
+        msr->start_capture(vm["capture"].as<std::string>());
     }
     if(vm.count("light_sensor"))
     {
@@ -115,7 +147,11 @@ int options_handler::handle_command(po::variables_map &vm, MSRTool *&msr)
     {
         msr->print_status();
     }
-    if(vm.count("getsensors"))
+    if(vm.count("stream"))
+    {
+        handle_stream_args(vm, *msr);
+    }
+    else if(vm.count("getsensors"))
     {
         handle_get_sensors(vm, *msr);
     }
@@ -151,6 +187,16 @@ int options_handler::handle_command(po::variables_map &vm, MSRTool *&msr)
         std::this_thread::sleep_for(std::chrono::seconds(5));
         msr->format_memory();
     }
+    else if(vm.count("fastformat"))
+    {
+        std::cout << "Formating the used memory. You got 5 seconds to cancel, else I will proceed!" << std::endl;
+        std::this_thread::sleep_for(std::chrono::seconds(5));
+        msr->format_memory(true);
+    }
+    if(vm.count("bench-link"))
+    {
+        msr->bench_link(vm["bench-link"].as<std::string>() == "csv");
+    }
     if(vm.count("list"))
     {
         msr->list_recordings();
@@ -207,12 +253,16 @@ int options_handler::handle_command(po::variables_map &vm, MSRTool *&msr)
     {
         handle_sampling_args(vm, *msr);
     }
+    int returnval = 0;
     if(vm.count("start"))
     {   //should be last arg to check
-        return handle_start_args(vm, *msr);
+        returnval = handle_start_args(vm, *msr);
     }
-
-    return 0;
+    if(vm.count("stats"))
+    {
+        std::cout << std::endl << msr->get_metrics().report();
+    }
+    return returnval;
 }
 
 void options_handler::handlelimits(po::variables_map &vm, MSRTool &msr)
@@ -285,6 +335,39 @@ limit_setting options_handler::parse_recording_limit(__attribute__((unused))std:
 }
 
 void options_handler::handle_get_sensors(po::variables_map &vm, MSRTool &msr)
+{
+    auto sensor_to_poll = parse_sensor_types(vm);
+    if(sensor_to_poll.size())
+        msr.print_sensors(sensor_to_poll);
+}
+
+int options_handler::handle_stream_args(po::variables_map &vm, MSRTool &msr)
+{
+    std::vector<sampletype> sensor_to_poll = {sampletype::pressure, sampletype::T_pressure,
+        sampletype::humidity, sampletype::T_humidity};
+    if(vm.count("getsensors"))
+        sensor_to_poll = parse_sensor_types(vm);
+    float rate = vm["stream"].as<float>();
+    if(rate <= 0)
+        throw po::error("The stream rate must be larger than 0");
+    float duration = 0;
+    if(vm.count("duration"))
+        duration = vm["duration"].as<float>();
+    std::string seperator = ",";
+    if(vm.count("seperator"))
+        seperator = vm["seperator"].as<std::string>();
+    std::filebuf fb;
+    std::ostream out_stream(std::cout.rdbuf());
+    if(vm.count("outfile"))
+    {
+        fb.open(vm["outfile"].as<std::string>(), std::ios::out);
+        out_stream.rdbuf(&fb);
+    }
+    msr.stream_sensors(sensor_to_poll, rate, duration, seperator, out_stream);
+    return 0;
+}
+
+std::vector<sampletype> options_handler::parse_sensor_types(po::variables_map &vm)
 {
     auto strings = vm["getsensors"].as<std::vector<std::string> >();
     std::vector<sampletype> sensor_to_poll;
@@ -305,8 +388,7 @@ void options_handler::handle_get_sensors(po::variables_map &vm, MSRTool &msr)
         else
             std::cerr << "Invalid sampletype selected" << std::endl;
     }
-    if(sensor_to_poll.size())
-        msr.print_sensors(sensor_to_poll);
+    return sensor_to_poll;
 }
 
 int options_handler::handle_extract_args(po::variables_map &vm, MSRTool &msr)
@@ -323,10 +405,117 @@ int options_handler::handle_extract_args(po::variables_map &vm, MSRTool &msr)
         fb.open(vm["outfile"].as<std::string>(), std::ios::out);
         out_stream.rdbuf(&fb);
     }
+    if(vm.count("follow"))
+    {
+        float interval = vm["follow"].as<float>();
+        if(interval <= 0)
+            throw po::error("The follow interval must be larger than 0");
+        uint32_t rec_num = vm["extract"].as<uint32_t>();
+        auto rec_list = msr.get_rec_list(rec_num + 1);
+        if(rec_list.size() < rec_num + 1)
+            throw po::error("The requested recording is not on the device!");
+        msr.follow_record(rec_list[rec_num], seperator, out_stream, interval);
+        return 0;
+    }
     msr.extract_record(vm["extract"].as<uint32_t>(), seperator, out_stream);
     return 0;
 }
 
+int options_handler::handle_client_args(po::variables_map &vm)
+{
+    std::string socket_path = vm["socket"].as<std::string>();
+    std::string device;
+    if(vm.count("device"))
+        device = vm["device"].as<std::string>();
+    if(device.compare(0, 7, "serial:") == 0)
+        device = device.substr(7);
+    int returnval = 0;
+    bool handled = false;
+    if(vm.count("status"))
+    {
+        returnval |= msr145d_request(socket_path, {"status", device}, std::cout);
+        handled = true;
+    }
+    if(vm.count("getsensors"))
+    {
+        std::vector<std::string> request = {"sensors", device};
+        for(auto type : parse_sensor_types(vm))
+            request.push_back(std::to_string(type));
+        returnval |= msr145d_request(socket_path, request, std::cout);
+        handled = true;
+    }
+    if(vm.count("list"))
+    {
+        returnval |= msr145d_request(socket_path, {"list", device}, std::cout);
+        handled = true;
+    }
+    if(vm.count("extract"))
+    {
+        std::string seperator = ",";
+        std::filebuf fb;
+        std::ostream out_stream(std::cout.rdbuf());
+        if(vm.count("seperator"))
+            seperator = vm["seperator"].as<std::string>();
+        if(vm.count("outfile"))
+        {
+            fb.open(vm["outfile"].as<std::string>(), std::ios::out);
+            out_stream.rdbuf(&fb);
+        }
+        returnval |= msr145d_request(socket_path,
+            {"extract", device, std::to_string(vm["extract"].as<uint32_t>()), seperator}, out_stream);
+        handled = true;
+    }
+    if(!handled)
+        throw po::error("Only --status, --getsensors, --list and --extract can be send to msr145d");
+    return returnval;
+}
+
+int options_handler::handle_harvest_args(po::variables_map &vm)
+{
+    std::string seperator = ",";
+    std::string outdir = ".";
+    size_t jobs = 8;
+    if(vm.count("seperator"))
+        seperator = vm["seperator"].as<std::string>();
+    if(vm.count("outdir"))
+        outdir = vm["outdir"].as<std::string>();
+    if(vm.count("jobs"))
+        jobs = std::max<size_t>(vm["jobs"].as<size_t>(), 1);
+    Harvester harvester(expand_port_patterns(vm["harvest"].as<std::vector<std::string> >()), jobs, outdir, seperator);
+    harvester.run();
+    std::cout << harvester.get_report();
+    int returnval = 0;
+    for(auto &result : harvester.get_results())
+        if(!result.ok) returnval = 1; //the report tells which
+    return returnval;
+}
+
+std::string options_handler::get_port_cache(po::variables_map &vm)
+{
+    if(vm.count("portcache"))
+        return vm["portcache"].as<std::string>();
+    const char *home = getenv("HOME");
+    if(home == nullptr)
+        return "";
+    return std::string(home) + "/.msr145_ports";
+}
+
+int options_handler::handle_discover_args(po::variables_map &vm)
+{
+    auto patterns = vm["discover"].as<std::vector<std::string> >();
+    if(patterns.size() == 0)
+        patterns = MSR_Discovery::get_default_patterns();
+    MSR_Discovery discovery(get_port_cache(vm));
+    auto devices = discovery.discover(expand_port_patterns(patterns));
+    std::cout << "Serial\tPort\t\tFirmware" << std::endl;
+    for(auto &device : devices)
+    {
+        std::cout << device.serial << "\t" << device.port << "\t"
+            << device.firmware_major << "." << std::setw(2) << std::setfill('0') << device.firmware_minor << std::endl;
+    }
+    return 0;
+}
+
 void options_handler::handle_sampling_args(po::variables_map &vm, MSRTool &msr)
 {
     if(vm.count("pressure") || vm.count("humidity") || vm.count("battery") || vm.count("blink") || vm.count("light"))